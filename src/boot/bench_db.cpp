@@ -0,0 +1,131 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : bench_db
+///
+
+// Usage: bench_db [rounds] [entries]
+// Reads a configuration json shaped like the one of the binary, with <entries> environment
+// variables and bindings, through ns_db::Db and ns_db::DbView. Reports the time and heap
+// allocations of each round, once parsing the json and once on an already parsed document
+
+#include <new>
+#include <atomic>
+#include <format>
+#include <string>
+#include <cstdlib>
+#include <functional>
+
+#include "../cpp/lib/db.hpp"
+#include "../cpp/lib/bench.hpp"
+#include "../cpp/macro.hpp"
+#include "../cpp/common.hpp"
+
+// Heap allocations of the process
+std::atomic<uint64_t> G_ALLOCATIONS = 0;
+
+// operator new() {{{
+// Not inlined, so the compiler does not pair new expressions with the free() of operator delete
+[[gnu::noinline]] void* operator new(size_t size)
+{
+  G_ALLOCATIONS.fetch_add(1, std::memory_order_relaxed);
+  if ( void* ptr = std::malloc(size) ) { return ptr; }
+  throw std::bad_alloc();
+} // operator new() }}}
+
+// operator delete() {{{
+[[gnu::noinline]] void operator delete(void* ptr) noexcept { std::free(ptr); }
+[[gnu::noinline]] void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+// operator delete() }}}
+
+// make_json() {{{
+// Configuration with a boot command, entries environment variables and entries bindings
+std::string make_json(uint64_t entries)
+{
+  std::string json = R"({"boot":{"program":"/bin/bash","args":["-c","true"]},"environment":[)";
+  for (uint64_t i = 0; i < entries; ++i)
+  {
+    json += std::format(R"({}"VAR_{}=/opt/app/{}")", (i > 0)? "," : "", i, i);
+  } // for
+  json += R"(],"bindings":{)";
+  for (uint64_t i = 0; i < entries; ++i)
+  {
+    json += std::format(R"({}"{}":{{"type":"ro","src":"/host/{}","dst":"/guest/{}"}})", (i > 0)? "," : "", i, i, i);
+  } // for
+  json += "}}";
+  return json;
+} // make_json() }}}
+
+// read_db() {{{
+// Reads the values the boot path needs, returns their total size so the reads are not elided
+uint64_t read_db(ns_db::Db const& db)
+{
+  uint64_t size = db["boot"]["program"].as_string().size();
+  for (auto&& entry : db["environment"].as_vector()) { size += entry.size(); }
+  auto db_bindings = db["bindings"];
+  for (auto&& key : db_bindings.keys())
+  {
+    auto db_binding = db_bindings[key];
+    size += db_binding["type"].as_string().size();
+    size += db_binding["src"].as_string().size();
+    size += db_binding["dst"].as_string().size();
+  } // for
+  return size;
+} // read_db() }}}
+
+// read_view() {{{
+uint64_t read_view(ns_db::DbView const& view)
+{
+  uint64_t size = view["boot"]["program"].as_string_view().size();
+  view["environment"].for_each([&](ns_db::DbView const& entry){ size += entry.as_string_view().size(); });
+  view["bindings"].for_each_item([&](auto&&, ns_db::DbView const& binding)
+  {
+    size += binding["type"].as_string_view().size();
+    size += binding["src"].as_string_view().size();
+    size += binding["dst"].as_string_view().size();
+  });
+  return size;
+} // read_view() }}}
+
+// measure() {{{
+// Runs f for rounds and reports the time and allocations of each round
+void measure(std::string_view name, uint64_t rounds, std::function<uint64_t()> const& f)
+{
+  uint64_t size = 0;
+  uint64_t allocations = G_ALLOCATIONS.load();
+  auto time_start = ns_bench::Clock::now();
+  for (uint64_t i = 0; i < rounds; ++i) { size += f(); }
+  double microseconds = ns_bench::since<ns_bench::Microseconds>(time_start);
+  allocations = G_ALLOCATIONS.load() - allocations;
+  println("{}: {} us/round, {} allocations/round, {} bytes read"
+    , name
+    , ns_bench::fixed(microseconds / rounds, 3)
+    , ns_bench::fixed(static_cast<double>(allocations) / rounds, 1)
+    , size / rounds
+  );
+} // measure() }}}
+
+// main() {{{
+int main(int argc, char** argv)
+{
+  ns_log::set_level(ns_log::Level::ERROR);
+  ereturn_if(argc > 3, "Usage: bench_db [rounds] [entries]", EXIT_FAILURE);
+  uint64_t rounds = (argc > 1)? std::stoull(argv[1]) : 10000;
+  uint64_t entries = (argc > 2)? std::stoull(argv[2]) : 32;
+  ereturn_if(rounds == 0, "Rounds must be positive", EXIT_FAILURE);
+  std::string json = make_json(entries);
+  println("json: {} bytes, rounds: {}, entries: {}", json.size(), rounds, entries);
+
+  // Parse and read, as each launch does
+  measure("Db parse+read", rounds, [&]{ return read_db(ns_db::Db(json)); });
+  measure("DbView parse+read", rounds, [&]{ return read_view(ns_db::DbView(json)); });
+
+  // Read an already parsed document
+  ns_db::Db db(json);
+  ns_db::DbView view(json);
+  measure("Db read", rounds, [&]{ return read_db(db); });
+  measure("DbView read", rounds, [&]{ return read_view(view); });
+
+  return EXIT_SUCCESS;
+} // main() }}}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,98 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : bench_environment
+///
+
+// Usage: bench_environment [variables]
+// Builds an environment of <variables> entries (default 128), overrides each of them and
+// materializes envp, with ns_environment::Environment and with the vector of strings it replaced.
+// Repeats with 4x and 16x the variables, linear models grow the time by the same factor
+
+#include <format>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <functional>
+
+#include "../cpp/lib/log.hpp"
+#include "../cpp/lib/environment.hpp"
+#include "../cpp/lib/bench.hpp"
+#include "../cpp/macro.hpp"
+#include "../cpp/common.hpp"
+
+// build_vector() {{{
+// Baseline, each variable is found by splitting every entry on '='
+size_t build_vector(std::vector<std::string> const& vec_entries)
+{
+  std::vector<std::string> vec_env;
+  auto f_set = [&](std::string const& entry)
+  {
+    std::string key = entry.substr(0, entry.find('='));
+    std::erase_if(vec_env, [&](std::string const& e)
+    {
+      std::istringstream stream(e);
+      std::string key_entry;
+      std::getline(stream, key_entry, '=');
+      return key_entry == key;
+    });
+    vec_env.push_back(entry);
+  };
+  std::ranges::for_each(vec_entries, f_set);
+  std::ranges::for_each(vec_entries, f_set);
+  std::vector<char*> vec_envp;
+  std::ranges::transform(vec_env, std::back_inserter(vec_envp), [](auto&& e){ return e.data(); });
+  vec_envp.push_back(nullptr);
+  return vec_envp.size();
+} // build_vector() }}}
+
+// build_environment() {{{
+size_t build_environment(std::vector<std::string> const& vec_entries)
+{
+  ns_environment::Environment environment;
+  for (auto&& entry : vec_entries) { environment.set(entry); }
+  for (auto&& entry : vec_entries) { environment.set(entry); }
+  char* const* envp = environment.envp();
+  size_t size = 0;
+  while ( envp[size] != nullptr ) { ++size; }
+  return size + 1;
+} // build_environment() }}}
+
+// measure() {{{
+// Reports the time of f in microseconds, averaged over rounds
+void measure(std::string_view name
+  , uint64_t rounds
+  , std::vector<std::string> const& vec_entries
+  , std::function<size_t(std::vector<std::string> const&)> const& f)
+{
+  size_t size = 0;
+  auto time_start = ns_bench::Clock::now();
+  for (uint64_t i = 0; i < rounds; ++i) { size += f(vec_entries); }
+  double microseconds = ns_bench::since<ns_bench::Microseconds>(time_start);
+  println("{} ({} variables): {} us, {} envp entries", name, vec_entries.size()
+    , ns_bench::fixed(microseconds / rounds, 1)
+    , size / rounds
+  );
+} // measure() }}}
+
+// main() {{{
+int main(int argc, char** argv)
+{
+  ns_log::set_level(ns_log::Level::ERROR);
+  ereturn_if(argc > 2, "Usage: bench_environment [variables]", EXIT_FAILURE);
+  uint64_t variables = (argc > 1)? std::stoull(argv[1]) : 128;
+  for (uint64_t factor : {1, 4, 16})
+  {
+    std::vector<std::string> vec_entries;
+    for (uint64_t i = 0; i < variables * factor; ++i)
+    {
+      vec_entries.push_back(std::format("VARIABLE_{}=/usr/share/value/{}", i, i));
+    } // for
+    // Fewer rounds on larger inputs, so the baseline finishes
+    uint64_t rounds = std::max<uint64_t>(64 / (factor * factor), 1);
+    measure("vector", rounds, vec_entries, build_vector);
+    measure("Environment", rounds, vec_entries, build_environment);
+  } // for
+  return EXIT_SUCCESS;
+} // main() }}}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,142 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : bench_layer
+///
+
+// Usage: bench_layer <layer-file>...
+// Mounts each layer, dwarfs, squashfs or erofs, with the FUSE tools found in PATH and reports
+// the MiB/s of reading all of its files sequentially and the reads/s of random 4 KiB reads.
+// Each pass starts from a fresh mount, so the cache of the filesystem process is cold
+
+#include <random>
+#include <vector>
+#include <string>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../cpp/lib/log.hpp"
+#include "../cpp/lib/fuse.hpp"
+#include "../cpp/lib/layer.hpp"
+#include "../cpp/lib/bench.hpp"
+#include "../cpp/macro.hpp"
+#include "../cpp/common.hpp"
+
+namespace fs = std::filesystem;
+
+// Size of each random read
+constexpr size_t const SIZE_READ_RANDOM = 4096;
+
+// Count of random reads of a pass
+constexpr uint64_t const COUNT_READ_RANDOM = 20000;
+
+// read_sequential() {{{
+// Reads every file of path_dir, returns the bytes read
+uint64_t read_sequential(fs::path const& path_dir)
+{
+  uint64_t bytes = 0;
+  std::vector<char> buffer(1 << 20);
+  std::error_code ec;
+  for (auto&& entry : fs::recursive_directory_iterator(path_dir, ec))
+  {
+    qcontinue_if(not entry.is_regular_file(ec) or entry.is_symlink(ec));
+    int fd = open(entry.path().c_str(), O_RDONLY | O_CLOEXEC);
+    econtinue_if(fd < 0, "Could not open '{}': {}"_fmt(entry.path(), strerror(errno)));
+    for (ssize_t count; (count = read(fd, buffer.data(), buffer.size())) != 0;)
+    {
+      qcontinue_if(count < 0 and errno == EINTR);
+      qbreak_if(count < 0);
+      bytes += count;
+    } // for
+    close(fd);
+  } // for
+  return bytes;
+} // read_sequential() }}}
+
+// read_random() {{{
+// Reads blocks at random offsets of random files of path_dir, returns the reads performed
+uint64_t read_random(fs::path const& path_dir)
+{
+  std::vector<std::pair<fs::path,uint64_t>> vec_files;
+  std::error_code ec;
+  for (auto&& entry : fs::recursive_directory_iterator(path_dir, ec))
+  {
+    qcontinue_if(not entry.is_regular_file(ec) or entry.is_symlink(ec));
+    uint64_t size = entry.file_size(ec);
+    qcontinue_if(ec or size == 0);
+    vec_files.emplace_back(entry.path(), size);
+  } // for
+  qreturn_if(vec_files.empty(), 0);
+  // Same sequence for every layer
+  std::mt19937_64 generator(42);
+  std::array<char,SIZE_READ_RANDOM> buffer;
+  uint64_t reads = 0;
+  for (uint64_t i = 0; i < COUNT_READ_RANDOM; ++i)
+  {
+    auto&& [path_file, size] = vec_files[generator() % vec_files.size()];
+    int fd = open(path_file.c_str(), O_RDONLY | O_CLOEXEC);
+    qcontinue_if(fd < 0);
+    reads += pread(fd, buffer.data(), buffer.size(), generator() % size) >= 0;
+    close(fd);
+  } // for
+  return reads;
+} // read_random() }}}
+
+// measure() {{{
+// Mounts path_file_layer on path_dir_mount, runs f on it and returns its result and the seconds
+std::pair<uint64_t,double> measure(fs::path const& path_file_layer
+  , fs::path const& path_dir_mount
+  , ns_layer::Format format
+  , std::function<uint64_t(fs::path const&)> const& f)
+{
+  auto layer = ns_layer::mount(format
+    , path_file_layer
+    , path_dir_mount
+    , 0
+    , fs::file_size(path_file_layer)
+    , uint64_t{512} << 20
+    , 2
+    , getpid()
+  );
+  ns_fuse::wait_fuse(path_dir_mount);
+  auto time_start = ns_bench::Clock::now();
+  uint64_t result = f(path_dir_mount);
+  return { result, ns_bench::since(time_start) };
+} // measure() }}}
+
+// main() {{{
+int main(int argc, char** argv)
+{
+  ns_log::set_level(ns_log::Level::ERROR);
+  ereturn_if(argc < 2, "Usage: bench_layer <layer-file>...", EXIT_FAILURE);
+
+  // Temporary mountpoint
+  std::string str_dir_temp = (fs::temp_directory_path() / "fim-bench-layer-XXXXXX").string();
+  ereturn_if(mkdtemp(str_dir_temp.data()) == nullptr, "Could not create temporary directory", EXIT_FAILURE);
+  fs::path path_dir_mount = str_dir_temp;
+
+  for (fs::path path_file_layer : std::vector<fs::path>(argv+1, argv+argc))
+  {
+    auto opt_format = ns_layer::detect(path_file_layer);
+    econtinue_if(not opt_format, "Unknown layer format of '{}'"_fmt(path_file_layer));
+    auto expected = ns_exception::to_expected([&]
+    {
+      auto [bytes, seconds_sequential] = measure(path_file_layer, path_dir_mount, *opt_format, read_sequential);
+      auto [reads, seconds_random] = measure(path_file_layer, path_dir_mount, *opt_format, read_random);
+      println("{} ({}, {} MiB): sequential {} MiB/s, random {} reads/s"
+        , path_file_layer.filename()
+        , ns_layer::to_string(*opt_format)
+        , fs::file_size(path_file_layer) >> 20
+        , ns_bench::fixed(ns_bench::rate(bytes >> 20, seconds_sequential), 1)
+        , ns_bench::fixed(ns_bench::rate(reads, seconds_random), 0)
+      );
+    });
+    elog_if(not expected, "Could not measure '{}': {}"_fmt(path_file_layer, expected.error()));
+  } // for
+
+  std::error_code ec;
+  fs::remove(path_dir_mount, ec);
+  return EXIT_SUCCESS;
+} // main() }}}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,86 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : bench_spawn
+///
+
+// Usage: bench_spawn [spawns] [ballast-mib]
+// Spawns '/bin/true' with ns_subprocess::Subprocess and with fork/execve while the process holds
+// <ballast-mib> MiB of touched memory (default 256). Reports the p50/p99 latency of a spawn and
+// wait, fork copies the page tables so its latency grows with the ballast
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <functional>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../cpp/lib/subprocess.hpp"
+#include "../cpp/lib/bench.hpp"
+#include "../cpp/macro.hpp"
+#include "../cpp/common.hpp"
+
+extern char** environ;
+
+// spawn_fork() {{{
+// Baseline, the spawn of Subprocess before it used clone
+void spawn_fork()
+{
+  char arg0[] = "/bin/true";
+  char* argv[] = {arg0, nullptr};
+  pid_t pid = fork();
+  if ( pid == 0 )
+  {
+    execve(argv[0], argv, environ);
+    _exit(127);
+  } // if
+  ereturn_if(pid < 0, "Could not fork: {}"_fmt(strerror(errno)));
+  int status;
+  while ( waitpid(pid, &status, 0) < 0 and errno == EINTR ) {}
+} // spawn_fork() }}}
+
+// spawn_subprocess() {{{
+void spawn_subprocess()
+{
+  ns_subprocess::Subprocess subprocess("/bin/true");
+  (void) subprocess.spawn().wait();
+} // spawn_subprocess() }}}
+
+// measure() {{{
+// Runs f for spawns and reports the latency of each run in microseconds
+void measure(std::string_view name, uint64_t spawns, std::function<void()> const& f)
+{
+  std::vector<double> vec_latencies;
+  for (uint64_t i = 0; i < spawns; ++i)
+  {
+    auto time_start = ns_bench::Clock::now();
+    f();
+    vec_latencies.push_back(ns_bench::since<ns_bench::Microseconds>(time_start));
+  } // for
+  println("{}: p50 {} us, p99 {} us"
+    , name
+    , ns_bench::fixed(ns_bench::percentile(vec_latencies, 0.50), 1)
+    , ns_bench::fixed(ns_bench::percentile(vec_latencies, 0.99), 1)
+  );
+} // measure() }}}
+
+// main() {{{
+int main(int argc, char** argv)
+{
+  ns_log::set_level(ns_log::Level::ERROR);
+  ereturn_if(argc > 3, "Usage: bench_spawn [spawns] [ballast-mib]", EXIT_FAILURE);
+  uint64_t spawns = (argc > 1)? std::stoull(argv[1]) : 1000;
+  uint64_t size_ballast = (argc > 2)? std::stoull(argv[2]) : 256;
+
+  // Touch the ballast so its pages are mapped
+  std::vector<char> ballast(size_ballast << 20);
+  std::memset(ballast.data(), 1, ballast.size());
+  println("spawns: {}, ballast: {} MiB", spawns, size_ballast);
+
+  measure("fork+execve", spawns, spawn_fork);
+  measure("Subprocess", spawns, spawn_subprocess);
+
+  return (ballast.empty() or ballast.back() == 1)? EXIT_SUCCESS : EXIT_FAILURE;
+} // main() }}}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <filesystem>
+#include <future>
 
 #include "../cpp/lib/linux.hpp"
 #include "../cpp/lib/env.hpp"
@@ -124,6 +125,9 @@ void relocate(char** argv)
   fs::path path_dir_instance = ns_linux::mkdtemp(path_dir_instance_prefix);
   ns_env::set("FIM_DIR_INSTANCE", path_dir_instance.c_str(), ns_env::Replace::Y);
 
+  // Save the owner pid (kept across execve) for fim-gc to detect stale instances
+  std::ofstream{path_dir_instance / "pid"} << getpid();
+
   // Path to directory with mount points
   fs::path path_dir_mount = path_dir_instance / "mount";
   ns_env::set("FIM_DIR_MOUNT", path_dir_mount.c_str(), ns_env::Replace::Y);
@@ -249,15 +253,31 @@ std::unique_ptr<ns_config::FlatimageConfig> boot(int argc, char** argv)
   // Set log file
   ns_log::set_sink_file(config->path_dir_mount.string() + ".boot.log");
 
+  // Remove instances left behind by crashed runs
+  ns_log::exception([&]{ ns_cmd::ns_gc::gc_if_due(config->path_dir_global); });
+
   // Start portal
-  ns_portal::Portal portal = ns_portal::Portal(config->path_dir_instance / "fim_boot");
+  ns_portal::Portal portal = ns_portal::Portal(config->path_dir_instance / "portal.sock");
+
+  // Refresh desktop integration in the background
+  auto future_desktop = std::async(std::launch::async, [&]{ ns_log::exception([&]{ ns_desktop::integrate(*config); }); });
 
-  // Refresh desktop integration
-  ns_log::exception([&]{ ns_desktop::integrate(*config); });
+  // Commands other than running a program may modify the image, let integration finish first
+  if ( argc > 1
+    and std::string_view{argv[1]}.starts_with("fim-")
+    and std::string_view{argv[1]} != "fim-exec"
+    and std::string_view{argv[1]} != "fim-root" )
+  {
+    future_desktop.wait();
+  } // if
 
   // Parse flatimage command if exists
   ns_parser::parse_cmds(*config, argc, argv);
 
+  // Close the binary before waiting for it to be released by other processes
+  future_desktop.wait();
+  ns_reserved::release();
+
   return config;
 } // boot() }}}
 
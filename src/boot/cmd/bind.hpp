@@ -46,14 +46,13 @@ inline index_t get_highest_index(ns_db::Db const& db)
 } // namespace
 
 // fn: add() {{{
-inline void add(fs::path const& path_file_config, CmdBind const& cmd)
+inline void add(ns_db::Db& db, CmdBind const& cmd)
 {
   // Get src and dst paths
   auto binds = ns_variant::get_if_holds_alternative<bind_t>(cmd.data);
   ereturn_if(not binds, "Invalid data type for 'add' command");
 
   // Find out the highest bind index
-  auto db = ns_db::Db(path_file_config, ns_db::Mode::UPDATE_OR_CREATE);
   index_t idx = get_highest_index(db) + 1;
   ns_log::info()("Binding index is '{}'", idx);
 
@@ -66,15 +65,12 @@ inline void add(fs::path const& path_file_config, CmdBind const& cmd)
 } // fn: add() }}}
 
 // fn: del() {{{
-inline decltype(auto) del(fs::path const& path_file_config, CmdBind const& cmd)
+inline decltype(auto) del(ns_db::Db& db, CmdBind const& cmd)
 {
   // Get index to delete
   auto index = ns_variant::get_if_holds_alternative<index_t>(cmd.data);
   ereturn_if(not index, "Invalid data type for 'del' command");
 
-  // Open db
-  auto db = ns_db::Db(path_file_config, ns_db::Mode::UPDATE_OR_CREATE);
-
   // Check if it exists
   auto items = db.items();
   auto it = std::ranges::find_if(items, [&](auto&& e){ return std::stoi(e.key()) == index; });
@@ -92,12 +88,11 @@ inline decltype(auto) del(fs::path const& path_file_config, CmdBind const& cmd)
 } // fn: del() }}}
 
 // fn: list() {{{
-inline decltype(auto) list(fs::path const& path_file_config)
+// Takes the json object of the configured bindings, empty if not configured
+inline decltype(auto) list(std::string_view json_bindings)
 {
-  // Open db
-  auto db = ns_db::Db(path_file_config, ns_db::Mode::UPDATE_OR_CREATE);
   // Print entries to stdout
-  println(db.dump(2));
+  println(ns_db::Db((json_bindings.empty())? "null" : json_bindings).dump(2));
 } // fn: list() }}}
 
 } // namespace ns_cmd::ns_bind
@@ -35,24 +35,6 @@ constexpr const std::array<uint32_t, 9> arr_sizes {16,22,24,32,48,64,96,128,256}
 
 namespace fs = std::filesystem;
 
-#pragma pack(push, 1)
-struct Image
-{
-  char m_ext[4];
-  char m_data[ns_config::SIZE_RESERVED_IMAGE - 12];
-  uint64_t m_size;
-  Image() = default;
-  Image(char* ext, char* data, uint64_t size)
-    : m_size(size)
-  {
-    // xxx + '\0'
-    std::copy(ext, ext+3, m_ext);
-    m_ext[3] = '\0';
-    std::copy(data, data+size, m_data);
-  } // Image
-};
-#pragma pack(pop)
-
 decltype(auto) get_path_file_icon_png(fs::path const& path_dir_home
   , std::string_view name_app
   , std::string_view template_dir
@@ -76,50 +58,16 @@ decltype(auto) get_path_file_icon_svg(fs::path const& path_dir_home
 // read_json_from_binary() {{{
 std::expected<std::string,std::string> read_json_from_binary(ns_config::FlatimageConfig const& config)
 {
-  auto expected_json = ns_reserved::ns_desktop::read(config.path_file_binary
-    , config.offset_desktop.offset
-    , config.offset_desktop.size
-  );
-  qreturn_if(not expected_json, expected_json.error());
-  return std::string{expected_json->get()};
+  return ns_reserved::ns_desktop::read(config.path_file_binary, config.offset_reserved);
 } // read_json_from_binary() }}}
 
 // write_json_to_binary() {{{
 std::error<std::string> write_json_to_binary(ns_config::FlatimageConfig const& config
   , std::string_view str_raw_json)
 {
-  return ns_reserved::ns_desktop::write(config.path_file_binary
-    , config.offset_desktop.offset
-    , config.offset_desktop.size
-    , str_raw_json.data()
-    , str_raw_json.size()
-  );
+  return ns_reserved::ns_desktop::write(config.path_file_binary, config.offset_reserved, str_raw_json);
 } // write_json_to_binary() }}}
 
-// read_image_from_binary() {{{
-std::expected<std::pair<std::unique_ptr<char[]>,uint64_t>,std::string> read_image_from_binary(fs::path const& path_file_binary
-  , uint64_t offset
-  , uint64_t size)
-{
-  auto ptr_data = std::make_unique<char[]>(size);
-  auto expected_bytes = ns_reserved::read(path_file_binary, offset, size, ptr_data.get());
-  qreturn_if(not expected_bytes, std::unexpected(expected_bytes.error()));
-  return std::make_pair(std::move(ptr_data), *expected_bytes);
-} // read_image_from_binary() }}}
-
-// write_image_to_binary() {{{
-std::error<std::string> write_image_to_binary(ns_config::FlatimageConfig const& config
-  , char* data
-  , uint64_t size)
-{
-  return ns_reserved::write(config.path_file_binary
-    , config.offset_desktop_image.offset
-    , config.offset_desktop_image.size
-    , data
-    , size
-  );
-} // write_image_to_binary() }}}
-
 // integrate_desktop_entry() {{{
 decltype(auto) integrate_desktop_entry(ns_db::ns_desktop::Desktop const& desktop
   , fs::path const& path_dir_home
@@ -256,20 +204,16 @@ inline void integrate_icons(ns_config::FlatimageConfig const& config, ns_db::ns_
     , "Icons are integrated with the system"
   );
   // Read picture from flatimage binary
-  Image image;
-  auto expected_data_image = read_image_from_binary(config.path_file_binary
-    , config.offset_desktop_image.offset
-    , sizeof(image)
-  );
-  ereturn_if(not expected_data_image, expected_data_image.error());
-  std::memcpy(&image, expected_data_image->first.get(), sizeof(image));
+  auto expected_icon = ns_reserved::ns_desktop::read_icon(config.path_file_binary, config.offset_reserved);
+  ereturn_if(not expected_icon, expected_icon.error());
+  auto const& [ext, data] = *expected_icon;
   // Create temporary file to write image to
-  auto expected_path_file_icon = ns_linux::mkstemps("/tmp", "XXXXXX.{}"_fmt(image.m_ext), 4);
+  auto expected_path_file_icon = ns_linux::mkstemps("/tmp", "XXXXXX.{}"_fmt(ext), 4);
   ereturn_if(not expected_path_file_icon, expected_path_file_icon.error());
   // Write image to temporary file
   std::ofstream file_icon(*expected_path_file_icon);
   ereturn_if(not file_icon.is_open(), "Could not open temporary image file for desktop integration");
-  file_icon.write(image.m_data, image.m_size);
+  file_icon.write(data.data(), data.size());
   file_icon.close();
   // Create icons
   if ( expected_path_file_icon->string().ends_with(".svg") )
@@ -380,7 +324,7 @@ inline void integrate(ns_config::FlatimageConfig const& config)
   } // if
 
   // Check if should notify
-  if ( auto expected = ns_reserved::ns_notify::read(config.path_file_binary, config.offset_notify.offset) )
+  if ( auto expected = ns_reserved::ns_notify::read(config.path_file_binary, config.offset_reserved) )
   {
     // Check for errors
     ereturn_if(not expected, "Could not read notify byte: '{}'"_fmt(expected.error()));
@@ -423,17 +367,11 @@ inline void setup(ns_config::FlatimageConfig const& config, fs::path const& path
     : "";
   ereturn_if(str_ext.empty(), "Icon extension '{}' is not supported"_fmt(path_file_icon.extension()));
   // Read original image
-  uintmax_t size_file_icon = fs::file_size(path_file_icon);
-  ereturn_if(size_file_icon >= config.offset_desktop_image.size, "File is too large, '{}' bytes"_fmt(size_file_icon));
-  auto expected_image_data = read_image_from_binary(path_file_icon, 0, size_file_icon);
-  ereturn_if(not expected_image_data, "Could not read source image: {}"_fmt(expected_image_data.error()));
-  // Create image struct to deserialize into binary format
-  Image image;
-  std::memcpy(image.m_ext, str_ext.data(), 3);
-  std::memcpy(image.m_data, expected_image_data->first.get(), expected_image_data->second);
-  image.m_size = expected_image_data->second;
-  // Serialize image struct in binary format
-  auto err = write_image_to_binary(config, reinterpret_cast<char*>(&image), sizeof(image));
+  std::ifstream file_icon(path_file_icon, std::ios::binary);
+  ereturn_if(not file_icon.is_open(), "Could not read source image '{}'"_fmt(path_file_icon));
+  std::string str_icon = ns_string::to_string(file_icon.rdbuf());
+  // Write image to the binary
+  auto err = ns_reserved::ns_desktop::write_icon(config.path_file_binary, config.offset_reserved, str_ext, str_icon);
   ereturn_if(err, "Could not write image data: {}"_fmt(*err));
   // Serialize json
   auto expected_str_raw_json = ns_db::ns_desktop::serialize(*expected_desktop);
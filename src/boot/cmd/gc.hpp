@@ -0,0 +1,179 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : gc
+///
+
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <optional>
+#include <filesystem>
+#include <csignal>
+#include <sys/stat.h>
+
+#include "../../cpp/lib/log.hpp"
+#include "../../cpp/lib/fuse.hpp"
+#include "../../cpp/macro.hpp"
+
+namespace ns_cmd::ns_gc
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+using namespace std::chrono_literals;
+
+// Instances without a pid file are only collected after this age
+constexpr auto const AGE_NO_PID_FILE = 24h;
+
+// Minimum interval between opportunistic collections
+constexpr auto const INTERVAL_GC = 1h;
+
+// fn: unescape() {{{
+// Decodes the octal escapes (e.g. '\040' for space) used in /proc/self/mountinfo
+inline std::string unescape(std::string const& str)
+{
+  std::string result;
+  for (size_t i = 0; i < str.size(); ++i)
+  {
+    if ( str[i] == '\\' and i + 3 < str.size() )
+    {
+      result += static_cast<char>(std::stoi(str.substr(i+1, 3), nullptr, 8));
+      i += 3;
+    } // if
+    else
+    {
+      result += str[i];
+    } // else
+  } // for
+  return result;
+} // fn: unescape() }}}
+
+// fn: get_mountpoints() {{{
+// Mountpoints located inside path_dir, deepest first
+inline std::vector<fs::path> get_mountpoints(fs::path const& path_dir)
+{
+  std::vector<fs::path> vec_path_dir_mountpoints;
+  std::ifstream file_mountinfo("/proc/self/mountinfo");
+  for (std::string line; std::getline(file_mountinfo, line);)
+  {
+    // The fifth field is the mountpoint
+    std::istringstream stream_line(line);
+    std::string field;
+    for (int i = 0; i < 5; ++i) { stream_line >> field; }
+    fs::path path_dir_mountpoint = unescape(field);
+    qcontinue_if(not path_dir_mountpoint.string().starts_with(path_dir.string() + "/"));
+    vec_path_dir_mountpoints.push_back(path_dir_mountpoint);
+  } // for
+  std::ranges::sort(vec_path_dir_mountpoints, std::greater<>{});
+  return vec_path_dir_mountpoints;
+} // fn: get_mountpoints() }}}
+
+// fn: is_stale() {{{
+// Checks if the process that created the instance directory is gone
+inline bool is_stale(fs::path const& path_dir_instance)
+{
+  // Only collect instances of the current user
+  struct stat stat_instance;
+  qreturn_if(lstat(path_dir_instance.c_str(), &stat_instance) < 0, false);
+  qreturn_if(not S_ISDIR(stat_instance.st_mode) or stat_instance.st_uid != getuid(), false);
+  // Check the owner process, EPERM means the process exists
+  if ( std::ifstream file_pid(path_dir_instance / "pid"); file_pid.is_open() )
+  {
+    pid_t pid{};
+    qreturn_if(not (file_pid >> pid) or pid <= 0, false);
+    return kill(pid, 0) < 0 and errno == ESRCH;
+  } // if
+  // Instances from older versions have no pid file
+  auto time_modified = std::chrono::system_clock::from_time_t(stat_instance.st_mtime);
+  return std::chrono::system_clock::now() - time_modified > AGE_NO_PID_FILE
+    and get_mountpoints(path_dir_instance).empty();
+} // fn: is_stale() }}}
+
+} // namespace
+
+// fn: gc() {{{
+// Removes instance directories left behind by dead processes, returns how many were removed
+inline uint64_t gc(fs::path const& path_dir_global, std::optional<std::chrono::milliseconds> opt_budget = std::nullopt)
+{
+  auto time_deadline = std::chrono::steady_clock::now() + opt_budget.value_or(std::chrono::milliseconds::zero());
+  auto f_is_expired = [&]{ return opt_budget and std::chrono::steady_clock::now() > time_deadline; };
+
+  // Find stale instances in '/tmp/fim/app/*/instance/*'
+  std::vector<fs::path> vec_path_dir_stale;
+  std::error_code ec;
+  for (auto&& entry_app : fs::directory_iterator(path_dir_global / "app", ec))
+  {
+    for (auto&& entry_instance : fs::directory_iterator(entry_app.path() / "instance", ec))
+    {
+      qbreak_if(f_is_expired());
+      qcontinue_if(not is_stale(entry_instance.path()));
+      vec_path_dir_stale.push_back(entry_instance.path());
+    } // for
+  } // for
+  qreturn_if(vec_path_dir_stale.empty(), 0);
+
+  // Lazily un-mount leftover filesystems
+  std::vector<fs::path> vec_path_dir_mountpoints;
+  for (auto&& path_dir_stale : vec_path_dir_stale)
+  {
+    std::ranges::copy(get_mountpoints(path_dir_stale), std::back_inserter(vec_path_dir_mountpoints));
+  } // for
+  ns_fuse::unmount(vec_path_dir_mountpoints);
+
+  // Never recurse into a directory that still has a filesystem mounted below it
+  std::erase_if(vec_path_dir_stale, [](auto&& e){ return not get_mountpoints(e).empty(); });
+
+  // Remove in parallel, in batches so the time budget is respected
+  uint64_t count_removed{};
+  size_t size_batch = std::max(std::thread::hardware_concurrency(), 1u);
+  for (auto it = vec_path_dir_stale.begin(); it != vec_path_dir_stale.end() and not f_is_expired();)
+  {
+    std::vector<std::future<std::error_code>> vec_futures;
+    for (; it != vec_path_dir_stale.end() and vec_futures.size() < size_batch; ++it)
+    {
+      vec_futures.push_back(std::async(std::launch::async, [path_dir = *it]
+      {
+        std::error_code ec;
+        fs::remove_all(path_dir, ec);
+        return ec;
+      }));
+    } // for
+    for (auto&& future : vec_futures)
+    {
+      std::error_code ec = future.get();
+      econtinue_if(ec, "Failed to remove stale instance: {}"_fmt(ec.message()));
+      count_removed += 1;
+    } // for
+  } // for
+
+  ns_log::debug()("Removed '{}' stale instances", count_removed);
+  return count_removed;
+} // fn: gc() }}}
+
+// fn: gc_if_due() {{{
+// Rate-limited collection with a small time budget, meant to run on every boot
+inline void gc_if_due(fs::path const& path_dir_global)
+{
+  fs::path path_file_stamp = path_dir_global / "gc.stamp";
+  std::error_code ec;
+  // Check when the last collection happened
+  if ( auto time_last = fs::last_write_time(path_file_stamp, ec); not ec )
+  {
+    qreturn_if(fs::file_time_type::clock::now() - time_last < INTERVAL_GC);
+  } // if
+  // Update stamp before collecting, so concurrent boots skip it
+  std::ofstream{path_file_stamp, std::ios::trunc};
+  fs::last_write_time(path_file_stamp, fs::file_time_type::clock::now(), ec);
+  gc(path_dir_global, 100ms);
+} // fn: gc_if_due() }}}
+
+} // namespace ns_cmd::ns_gc
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
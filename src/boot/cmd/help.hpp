@@ -75,7 +75,7 @@ inline std::string help_usage()
     .with_args({
       { "cmd", "Name of the command to display help details" },
     })
-    .with_note("Available commands: fim-{exec,root,perms,env,desktop,layer,bind,commit,boot}")
+    .with_note("Available commands: fim-{exec,root,perms,env,desktop,layer,bind,commit,boot,gc}")
     .with_example(R"(fim-help bind")")
     .get();
 }
@@ -173,15 +173,19 @@ inline std::string layer_usage()
       { "create", "Creates a novel layer from <in-dir> and save in <out-file>" },
       { "add", "Includes the novel layer <in-file> in the image in the top of the layer stack" },
     })
-    .with_usage("fim-layer create <in-dir> <out-file>")
+    .with_usage("fim-layer create <in-dir> <out-file> [--format <format>]")
     .with_args({
       { "in-dir", "Input directory to create a novel layer from"},
       { "out-file" , "Output file name of the layer file"},
+      { "format" , "Filesystem of the layer, dwarfs (default), squashfs or erofs"},
     })
     .with_usage("fim-layer add <in-file>")
     .with_args({
       { "in-file", "Path to the layer file to include in the FlatImage"},
     })
+    .with_note("dwarfs compresses better, squashfs and erofs (lz4) are faster on random access")
+    .with_note("squashfs layers ignore FIM_COMPRESSION_LEVEL, they always use lz4 high compression")
+    .with_note("Each dwarfs layer runs its own process, FIM_DWARFS_CACHE_SIZE MiB of cache (default 512) and FIM_DWARFS_WORKERS workers (default 2) are split between them, every layer uses at least one worker and a 16 MiB block of cache")
     .get();
 }
 
@@ -258,6 +262,14 @@ inline std::string boot_usage()
     .get();
 }
 
+inline std::string gc_usage()
+{
+  return HelpEntry{"fim-gc"}
+    .with_description("Removes data and mounts left behind by FlatImage instances that are no longer running")
+    .with_usage("fim-gc")
+    .with_note("This also runs at most once an hour on startup, within a small time budget")
+    .get();
+}
 
 } // namespace ns_cmd::ns_help
 
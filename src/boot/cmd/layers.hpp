@@ -7,8 +7,13 @@
 
 #include <cmath>
 #include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "../../cpp/lib/subprocess.hpp"
+#include "../../cpp/lib/layer.hpp"
+#include "../../cpp/std/exception.hpp"
 
 namespace
 {
@@ -21,49 +26,160 @@ namespace ns_layers
 {
 
 // fn: create() {{{
-inline void create(fs::path const& path_dir_src, fs::path const& path_file_dst, uint64_t compression_level)
+inline void create(fs::path const& path_dir_src
+  , fs::path const& path_file_dst
+  , uint64_t compression_level
+  , ns_layer::Format format = ns_layer::Format::DWARFS)
 {
-  // Find mkdwarfs binary
-  auto opt_path_file_mkdwarfs = ns_subprocess::search_path("mkdwarfs");
-  ethrow_if(not opt_path_file_mkdwarfs, "Could not find 'mkdwarfs' binary");
-
   // Compression level must be at least 1 and less or equal to 10
   compression_level = (compression_level > 9)? 9 : compression_level;
 
   // // Convert to non-percentual compression level
   // compression_level = std::ceil(22 * (static_cast<double>(compression_level) / 10));
 
+  // Select the tool to create the filesystem with
+  std::string str_tool = (format == ns_layer::Format::DWARFS)? "mkdwarfs"
+    : (format == ns_layer::Format::SQUASHFS)? "mksquashfs"
+    : "mkfs.erofs";
+  auto opt_path_file_tool = ns_subprocess::search_path(str_tool);
+  ethrow_if(not opt_path_file_tool, "Could not find '{}' binary"_fmt(str_tool));
+
   // Compress filesystem
+  ns_log::info()("Layer format: '{}'", ns_layer::to_string(format));
   ns_log::info()("Compression level: '{}'", compression_level);
   ns_log::info()("Compress filesystem to '{}'", path_file_dst);
-  auto ret = ns_subprocess::Subprocess(*opt_path_file_mkdwarfs)
-    .with_args("-i", path_dir_src, "-o", path_file_dst)
-    .with_args("-l", compression_level)
-    .spawn()
-    .wait();
-  ethrow_if(not ret, "mkdwarfs process exited abnormally");
-  ethrow_if(*ret != 0, "mkdwarfs process exited with error code '{}'"_fmt(*ret));
+  auto subprocess = ns_subprocess::Subprocess(*opt_path_file_tool);
+  switch(format)
+  {
+    case ns_layer::Format::DWARFS:
+      (void) subprocess.with_args("-i", path_dir_src, "-o", path_file_dst, "-l", compression_level);
+    break;
+    // lz4 trades compression ratio for fast random access, mksquashfs has no level for it
+    case ns_layer::Format::SQUASHFS:
+      (void) subprocess.with_args(path_dir_src, path_file_dst, "-noappend", "-comp", "lz4", "-Xhc");
+    break;
+    case ns_layer::Format::EROFS_FS:
+      (void) subprocess.with_args("-zlz4hc,{}"_fmt(compression_level + 3), path_file_dst, path_dir_src);
+    break;
+  } // switch
+  auto ret = subprocess.spawn().wait();
+  ethrow_if(not ret, "{} process exited abnormally"_fmt(str_tool));
+  ethrow_if(*ret != 0, "{} process exited with error code '{}'"_fmt(str_tool, *ret));
 } // fn: create() }}}
 
-// fn: add() {{{
-inline void add(fs::path const& path_file_binary, fs::path const& path_file_layer)
+// fn: find_end() {{{
+// Walks the published layers and returns the offset right after the last complete one
+inline uint64_t find_end(int fd_binary, uint64_t offset, uint64_t size_binary)
 {
-  // Open binary file for writing
-  std::ofstream file_binary(path_file_binary, std::ios::app | std::ios::binary);
-  std::ifstream file_layer(path_file_layer, std::ios::in | std::ios::binary);
-  ereturn_if(not file_binary.is_open(), "Failed to open output file '{}'"_fmt(path_file_binary))
-  ereturn_if(not file_layer.is_open(), "Failed to open input file '{}'"_fmt(path_file_layer))
-  // Get byte size
-  uint64_t file_size = fs::file_size(path_file_layer);
-  // Write byte size
-  file_binary.write(reinterpret_cast<char*>(&file_size), sizeof(file_size));
-  char buff[8192];
-  while( file_layer.read(buff, sizeof(buff)) or file_layer.gcount() > 0 )
+  while ( offset + sizeof(uint64_t) <= size_binary )
   {
-    file_binary.write(buff, file_layer.gcount());
-    ereturn_if(not file_binary, "Error writing data to file");
+    uint64_t size_layer{};
+    qbreak_if(pread(fd_binary, &size_layer, sizeof(size_layer), offset) != sizeof(size_layer));
+    // A zero or overflowing size is a layer that was never published
+    qbreak_if(size_layer == 0 or size_layer > size_binary - offset - sizeof(size_layer));
+    offset += sizeof(size_layer) + size_layer;
   } // while
-  ns_log::info()("Included novel layer from file '{}'", path_file_layer);
+  return offset;
+} // fn: find_end() }}}
+
+// fn: copy() {{{
+// Copies 'size' bytes from the start of fd_src to fd_dst at 'offset'
+// copy_file_range moves the data in the kernel, without a round trip through user space
+inline void copy(int fd_src, int fd_dst, uint64_t offset, uint64_t size)
+{
+  loff_t offset_src = 0;
+  loff_t offset_dst = offset;
+  // Copy in kernel space
+  while ( size > 0 )
+  {
+    ssize_t bytes = copy_file_range(fd_src, &offset_src, fd_dst, &offset_dst, size, 0);
+    // Not supported across these filesystems, fallback to read/write
+    qbreak_if(bytes < 0 and (errno == EXDEV or errno == ENOSYS or errno == EINVAL or errno == EOPNOTSUPP));
+    ethrow_if(bytes < 0, "Failed to copy layer: {}"_fmt(strerror(errno)));
+    ethrow_if(bytes == 0, "Unexpected end of layer file");
+    size -= bytes;
+  } // while
+  // Copy in user space
+  std::vector<char> buffer(size > 0? 1 << 20 : 0);
+  while ( size > 0 )
+  {
+    ssize_t bytes_read = pread(fd_src, buffer.data(), std::min<uint64_t>(buffer.size(), size), offset_src);
+    ethrow_if(bytes_read < 0, "Failed to read layer: {}"_fmt(strerror(errno)));
+    ethrow_if(bytes_read == 0, "Unexpected end of layer file");
+    for(ssize_t bytes_written = 0; bytes_written < bytes_read;)
+    {
+      ssize_t bytes = pwrite(fd_dst, buffer.data() + bytes_written, bytes_read - bytes_written, offset_dst + bytes_written);
+      ethrow_if(bytes < 0, "Failed to write layer: {}"_fmt(strerror(errno)));
+      bytes_written += bytes;
+    } // for
+    offset_src += bytes_read;
+    offset_dst += bytes_read;
+    size -= bytes_read;
+  } // while
+} // fn: copy() }}}
+
+// fn: append() {{{
+inline void append(int fd_binary, int fd_layer, uint64_t offset_filesystem)
+{
+  struct stat stat_binary, stat_layer;
+  ethrow_if(fstat(fd_binary, &stat_binary) < 0, "Failed to stat binary: {}"_fmt(strerror(errno)));
+  ethrow_if(fstat(fd_layer, &stat_layer) < 0, "Failed to stat layer: {}"_fmt(strerror(errno)));
+  uint64_t size_binary = stat_binary.st_size;
+  uint64_t size_layer = stat_layer.st_size;
+  ethrow_if(size_layer == 0, "Layer file is empty");
+  // Discard leftovers of an interrupted append
+  uint64_t offset = find_end(fd_binary, offset_filesystem, size_binary);
+  if ( offset < size_binary )
+  {
+    ns_log::info()("Discarding '{}' bytes of unpublished layer data", size_binary - offset);
+    ethrow_if(ftruncate(fd_binary, offset) < 0, "Failed to truncate binary: {}"_fmt(strerror(errno)));
+  } // if
+  // Reserve space so a full disk fails here instead of midway through the copy
+  if ( fallocate(fd_binary, 0, offset, sizeof(size_layer) + size_layer) < 0 )
+  {
+    ethrow_if(errno != EOPNOTSUPP, "Failed to allocate space for layer: {}"_fmt(strerror(errno)));
+  } // if
+  // Copy the layer, on failure rollback to the previous size
+  auto f_rollback = [&]{ elog_if(ftruncate(fd_binary, offset) < 0, "Failed to rollback binary"); };
+  try
+  {
+    copy(fd_layer, fd_binary, offset + sizeof(size_layer), size_layer);
+    ethrow_if(fsync(fd_binary) < 0, "Failed to sync layer data: {}"_fmt(strerror(errno)));
+  } // try
+  catch(...)
+  {
+    f_rollback();
+    throw;
+  } // catch
+  // Publish the layer by writing its size, which is what readers use to find it
+  if ( pwrite(fd_binary, &size_layer, sizeof(size_layer), offset) != sizeof(size_layer) or fsync(fd_binary) < 0 )
+  {
+    f_rollback();
+    "Failed to publish layer: {}"_throw(strerror(errno));
+  } // if
+} // fn: append() }}}
+
+// fn: add() {{{
+inline void add(fs::path const& path_file_binary, uint64_t offset_filesystem, fs::path const& path_file_layer)
+{
+  // Check if layer is a valid filesystem
+  auto opt_format = ns_layer::detect(path_file_layer);
+  ethrow_if(not opt_format, "'{}' is not a dwarfs, squashfs or erofs filesystem"_fmt(path_file_layer));
+  // Open files
+  int fd_layer = open(path_file_layer.c_str(), O_RDONLY | O_CLOEXEC);
+  ethrow_if(fd_layer < 0, "Failed to open input file '{}'"_fmt(path_file_layer));
+  int fd_binary = open(path_file_binary.c_str(), O_RDWR | O_CLOEXEC);
+  if ( fd_binary < 0 )
+  {
+    close(fd_layer);
+    "Failed to open output file '{}'"_throw(path_file_binary);
+  } // if
+  // Append layer
+  auto expected = ns_exception::to_expected([&]{ append(fd_binary, fd_layer, offset_filesystem); return true; });
+  close(fd_layer);
+  close(fd_binary);
+  ethrow_if(not expected, expected.error());
+  ns_log::info()("Included novel {} layer from file '{}'", ns_layer::to_string(*opt_format), path_file_layer);
 } // fn: add() }}}
 
 } // namespace ns_layers
@@ -9,6 +9,7 @@
 #include <filesystem>
 
 #include "../../cpp/lib/env.hpp"
+#include "../../cpp/lib/reserved.hpp"
 
 #ifndef FIM_DIST
 #define FIM_DIST "TRUNK"
@@ -22,17 +23,24 @@ namespace
 
 namespace fs = std::filesystem;
 
-struct Offset
+// get_unsigned() {{{
+// Non-negative integer of an environment variable, value_default if it is unset or invalid
+inline uint64_t get_unsigned(std::string_view name, uint64_t value_default)
 {
-  uint64_t offset;
-  uint64_t size;
-};
+  auto expected = ns_exception::to_expected([&]
+  {
+    std::string value = ns_env::get_or_else(name, std::to_string(value_default));
+    size_t pos = 0;
+    long long number = std::stoll(value, &pos);
+    ethrow_if(pos != value.size() or number < 0, "Invalid value '{}' for '{}'"_fmt(value, name));
+    return static_cast<uint64_t>(number);
+  });
+  ereturn_if(not expected, expected.error(), value_default);
+  return *expected;
+} // get_unsigned() }}}
 
 } // namespace
 
-constexpr int64_t const SIZE_RESERVED_TOTAL = 2097152;
-constexpr int64_t const SIZE_RESERVED_IMAGE = 1048576;
-
 // struct FlatimageConfig {{{
 struct FlatimageConfig
 {
@@ -42,10 +50,6 @@ struct FlatimageConfig
   bool is_debug;
 
   uint64_t offset_reserved;
-  Offset offset_permissions;
-  Offset offset_notify;
-  Offset offset_desktop;
-  Offset offset_desktop_image;
   uint64_t offset_filesystem;
   fs::path path_dir_global;
   fs::path path_dir_mount;
@@ -73,6 +77,8 @@ struct FlatimageConfig
   fs::path path_file_config_casefold;
 
   uint32_t layer_compression_level;
+  uint64_t dwarfs_cache_size;
+  uint32_t dwarfs_workers;
 
   std::string env_path;
 }; // }}}
@@ -95,15 +101,8 @@ inline FlatimageConfig config()
 
   // Paths in /tmp
   config.offset_reserved          = std::stoll(ns_env::get_or_throw("FIM_OFFSET"));
-  // Reserve 8 first bytes for permission data
-  config.offset_permissions       = { config.offset_reserved, 8 };
-  // Reserve next byte to check if notify is enabled
-  config.offset_notify            = { config.offset_permissions.offset + config.offset_permissions.size, 1 };
-  // Desktop entry information, reserve 4096 bytes for json data
-  config.offset_desktop           = { config.offset_notify.offset + config.offset_notify.size, 4096 };
-  // Space reserved for desktop icon
-  config.offset_desktop_image     = { config.offset_reserved + SIZE_RESERVED_TOTAL - SIZE_RESERVED_IMAGE, SIZE_RESERVED_IMAGE};
-  config.offset_filesystem        = config.offset_reserved + SIZE_RESERVED_TOTAL;
+  // Permissions, notify, desktop integration and configuration are fields of the reserved space
+  config.offset_filesystem        = config.offset_reserved + ns_reserved::SIZE;
   config.path_dir_global          = ns_env::get_or_throw("FIM_DIR_GLOBAL");
   config.path_file_binary         = ns_env::get_or_throw("FIM_FILE_BINARY");
   config.path_dir_binary          = config.path_file_binary.parent_path();
@@ -113,6 +112,7 @@ inline FlatimageConfig config()
   config.path_dir_instance        = ns_env::get_or_throw("FIM_DIR_INSTANCE");
   config.path_dir_mount           = ns_env::get_or_throw("FIM_DIR_MOUNT");
   config.path_file_bashrc         = config.path_dir_app / ".bashrc";
+  ns_env::set("BASHRC_FILE", config.path_file_bashrc, ns_env::Replace::Y);
   config.path_file_bash           = config.path_dir_app_bin / "bash";
   config.path_dir_mount_layers    = config.path_dir_mount / "layers";
   config.path_dir_mount_overlayfs = config.path_dir_mount / "overlayfs";
@@ -148,13 +148,17 @@ inline FlatimageConfig config()
   config.env_path += ":/sbin:/usr/sbin:/usr/local/sbin:/bin:/usr/bin:/usr/local/bin";
   config.env_path += ":{}"_fmt(config.path_dir_busybox.string());
   ns_env::set("PATH", config.env_path, ns_env::Replace::Y);
+  // Tools extracted by boot are resolved once, they come first in PATH
+  ns_subprocess::search_path_register(config.path_dir_app_bin, config.env_path);
 
   // Compression level configuration (goes from 0 to 10, default is 7)
-  config.layer_compression_level  = ns_exception::to_expected([]{ return std::stoi(ns_env::get_or_else("FIM_COMPRESSION_LEVEL", "7")); })
-    .value_or(7);
-  config.layer_compression_level = std::clamp(config.layer_compression_level, uint32_t{0}, uint32_t{10});
+  config.layer_compression_level = std::min(get_unsigned("FIM_COMPRESSION_LEVEL", 7), uint64_t{10});
+
+  // Memory and thread budget split between the dwarfs layers (cache size in MiB, default is 512)
+  config.dwarfs_cache_size = std::clamp(get_unsigned("FIM_DWARFS_CACHE_SIZE", 512), uint64_t{1}, uint64_t{1} << 32) * 1024 * 1024;
+  config.dwarfs_workers = std::clamp(get_unsigned("FIM_DWARFS_WORKERS", 2), uint64_t{1}, uint64_t{1024});
 
-  // Paths to the configuration files
+  // Paths to the configuration files, only read to move them to the binary
   config.path_dir_static              = config.path_dir_mount_overlayfs / "fim/static";
   config.path_file_config_boot        = config.path_dir_mount_overlayfs / "fim/config/boot.json";
   config.path_file_config_environment = config.path_dir_mount_overlayfs / "fim/config/environment.json";
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <set>
 #include <ranges>
 #include <filesystem>
 
@@ -34,36 +35,40 @@ inline std::vector<std::string> validate(std::vector<std::string> const& entries
     | std::ranges::to<std::vector<std::string>>();
 } // validate
 
+// Erases the entries with the given keys
+inline void erase(ns_db::Db& db, std::vector<std::string> const& keys)
+{
+  qreturn_if(not db.is_array());
+  std::set<std::string> set_keys(keys.begin(), keys.end());
+  db.array_erase_if([&](std::string const& entry){ return set_keys.contains(entry.substr(0, entry.find('='))); });
+} // erase
+
 } // namespace
 
-inline void del(fs::path const& path_file_config_environment, std::vector<std::string> const& entries)
+inline void del(ns_db::Db& db, std::vector<std::string> const& entries)
 {
-  for(auto&& entry : entries)
-  {
-    ns_db::Db(path_file_config_environment, ns_db::Mode::UPDATE).array_erase_if(ns_functional::StartsWith(entry + "="));
-  } // for
+  erase(db, entries);
 }
 
-inline void set(fs::path const& path_file_config_environment, std::vector<std::string> entries)
+inline void set(ns_db::Db& db, std::vector<std::string> entries)
 {
   entries = validate(entries);
-  if ( fs::exists(path_file_config_environment) )
-  {
-    ns_exception::ignore([&]{ del(path_file_config_environment, keys(entries)); });
-  } // if
-  ns_db::Db(path_file_config_environment, ns_db::Mode::CREATE).set_insert(entries);
+  db = std::vector<std::string>{};
+  db.set_insert(entries);
 }
 
-inline void add(fs::path const& path_file_config_environment, std::vector<std::string> entries)
+inline void add(ns_db::Db& db, std::vector<std::string> entries)
 {
   entries = validate(entries);
-  ns_exception::ignore([&]{ del(path_file_config_environment, keys(entries)); });
-  ns_db::Db(path_file_config_environment, ns_db::Mode::UPDATE_OR_CREATE).set_insert(entries);
+  erase(db, keys(entries));
+  db.set_insert(entries);
 }
 
-inline std::vector<std::string> get(fs::path const& path_file_config_environment)
+// Takes the json array of the configured environment, empty if not configured
+inline std::vector<std::string> get(std::string_view json_environment)
 {
-  std::vector<std::string> environment = ns_db::Db(path_file_config_environment, ns_db::Mode::READ).as_vector();
+  qreturn_if(json_environment.empty(), {});
+  std::vector<std::string> environment = ns_db::DbView(json_environment).as_vector();
   // Expand variables
   for(auto& variable : environment)
   {
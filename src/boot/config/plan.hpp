@@ -0,0 +1,345 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : plan
+///
+
+#pragma once
+
+#include <set>
+#include <array>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <fstream>
+#include <optional>
+#include <filesystem>
+
+#include "../../cpp/lib/db.hpp"
+#include "../../cpp/lib/env.hpp"
+#include "../../cpp/lib/log.hpp"
+#include "../../cpp/lib/linux.hpp"
+
+// Launch plan, the environment and bindings of the configuration resolved by a previous launch.
+// It is reused while the configuration and the host variables it references are unchanged, so a
+// warm launch does not parse the configuration json nor perform word expansion. Entries with command
+// substitution, globs, '~name', special parameters or shell variables such as RANDOM are stored as
+// is and expanded on every launch
+
+namespace ns_config::ns_plan
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Identifies the format of the plan file
+constexpr std::string_view const MAGIC = "FIMPLAN3";
+
+// Special parameters, as in '$$' or '${#VAR}', their values are computed by the shell
+constexpr std::string_view const PARAMETERS_SPECIAL = "$!?#-@*0123456789";
+
+// Variables computed by the shell on each expansion
+constexpr std::array<std::string_view,8> const VARIABLES_SHELL
+{
+  "PPID", "RANDOM", "SRANDOM", "SECONDS", "LINENO", "BASHPID", "EPOCHSECONDS", "EPOCHREALTIME"
+};
+
+// struct Entry {{{
+// A configuration value, dynamic values are expanded on each launch
+struct Entry
+{
+  bool is_dynamic;
+  std::string value;
+}; // struct Entry }}}
+
+// struct Plan {{{
+struct Plan
+{
+  // Hashes of the environment and bindings json
+  uint64_t hash_environment;
+  uint64_t hash_bindings;
+  // Host variables referenced by the entries and the hash of their values
+  std::vector<std::string> vec_variables;
+  uint64_t hash_variables;
+  std::vector<Entry> vec_environment;
+  // Each bind is its type followed by the source and destination
+  std::vector<std::array<Entry,3>> vec_binds;
+}; // struct Plan }}}
+
+// fn: is_dynamic() {{{
+// Entries with command substitutions, globs, '~name', special parameters or variables computed by
+// the shell depend on more than the host variables and are expanded on every launch
+inline bool is_dynamic(std::string_view entry)
+{
+  qreturn_if(entry.contains("$(") or entry.contains('`'), true);
+  auto f_is_name = [](char c){ return std::isalnum(static_cast<unsigned char>(c)) or c == '_'; };
+  for (size_t pos = entry.find('$'); pos != std::string_view::npos; pos = entry.find('$', pos + 1))
+  {
+    size_t begin = pos + 1 + (pos + 1 < entry.size() and entry[pos+1] == '{');
+    qcontinue_if(begin >= entry.size());
+    qreturn_if(PARAMETERS_SPECIAL.contains(entry[begin]), true);
+    size_t end = begin;
+    while ( end < entry.size() and f_is_name(entry[end]) ) { ++end; }
+    qreturn_if(std::ranges::find(VARIABLES_SHELL, entry.substr(begin, end - begin)) != VARIABLES_SHELL.end(), true);
+    // Skip the name, '$$' is checked as a single parameter
+    pos = std::max(pos, end - 1);
+  } // for
+  qreturn_if(entry.find_first_of("*?[") != std::string_view::npos, true);
+  // '~name' is the home of another user, '~' and '~/' only depend on HOME
+  for (size_t pos = entry.find('~'); pos != std::string_view::npos; pos = entry.find('~', pos + 1))
+  {
+    qreturn_if(pos + 1 < entry.size() and entry[pos+1] != '/' and entry[pos+1] != ':', true);
+  } // for
+  return false;
+} // fn: is_dynamic() }}}
+
+// fn: add_variables() {{{
+// Inserts the variables referenced as '$NAME', '${NAME...}' or '~' in entry into set_variables
+inline void add_variables(std::string_view entry, std::set<std::string>& set_variables)
+{
+  if ( entry.contains('~') ) { set_variables.insert("HOME"); }
+  auto f_is_name = [](char c){ return std::isalnum(static_cast<unsigned char>(c)) or c == '_'; };
+  for (size_t pos = entry.find('$'); pos != std::string_view::npos; pos = entry.find('$', pos + 1))
+  {
+    size_t begin = pos + 1 + (pos + 1 < entry.size() and entry[pos+1] == '{');
+    size_t end = begin;
+    while ( end < entry.size() and f_is_name(entry[end]) ) { ++end; }
+    qcontinue_if(end == begin);
+    set_variables.insert(std::string{entry.substr(begin, end - begin)});
+  } // for
+} // fn: add_variables() }}}
+
+// fn: hash() {{{
+// FNV-1a of data, continued from a previous hash
+inline uint64_t hash(std::string_view data, uint64_t seed = 14695981039346656037ull)
+{
+  for (char c : data) { seed = (seed ^ static_cast<uint8_t>(c)) * 1099511628211ull; }
+  return seed;
+} // fn: hash() }}}
+
+// fn: hash_variables() {{{
+// Hash of the current values of the variables, unset and empty variables differ
+inline uint64_t hash_variables(std::vector<std::string> const& vec_variables)
+{
+  uint64_t hash_values = hash("");
+  for (auto&& variable : vec_variables)
+  {
+    hash_values = hash(variable, hash_values);
+    const char* value = ns_env::get(variable.c_str());
+    hash_values = hash((value)? "=" : "", hash_values);
+    hash_values = hash((value)? value : "", hash_values);
+    hash_values = hash({"\0", 1}, hash_values);
+  } // for
+  return hash_values;
+} // fn: hash_variables() }}}
+
+// fn: write() {{{
+template<typename T>
+requires std::is_arithmetic_v<T>
+inline void write(std::string& data, T value)
+{
+  data.append(reinterpret_cast<char const*>(&value), sizeof(value));
+} // fn: write() }}}
+
+// fn: write() {{{
+inline void write(std::string& data, std::string_view value)
+{
+  write(data, static_cast<uint32_t>(value.size()));
+  data.append(value);
+} // fn: write() }}}
+
+// fn: write() {{{
+inline void write(std::string& data, Entry const& entry)
+{
+  write(data, static_cast<uint8_t>(entry.is_dynamic));
+  write(data, std::string_view{entry.value});
+} // fn: write() }}}
+
+// class Reader {{{
+// Reads the values written by write(), throws past the end of the data
+class Reader
+{
+  private:
+    std::string_view m_data;
+
+    std::string_view take(size_t size)
+    {
+      ethrow_if(size > m_data.size(), "Truncated launch plan");
+      std::string_view view = m_data.substr(0, size);
+      m_data.remove_prefix(size);
+      return view;
+    } // take
+
+  public:
+    explicit Reader(std::string_view data) : m_data(data) {}
+
+    template<typename T>
+    T read()
+    {
+      T value;
+      std::memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+      return value;
+    } // read
+
+    std::string string()
+    {
+      return std::string{take(read<uint32_t>())};
+    } // string
+
+    Entry entry()
+    {
+      bool is_dynamic = read<uint8_t>();
+      return Entry{ .is_dynamic = is_dynamic, .value = string() };
+    } // entry
+}; // class Reader }}}
+
+// fn: serialize() {{{
+inline std::string serialize(Plan const& plan)
+{
+  std::string data{MAGIC};
+  write(data, plan.hash_environment);
+  write(data, plan.hash_bindings);
+  write(data, static_cast<uint32_t>(plan.vec_variables.size()));
+  std::ranges::for_each(plan.vec_variables, [&](auto&& e){ write(data, std::string_view{e}); });
+  write(data, plan.hash_variables);
+  write(data, static_cast<uint32_t>(plan.vec_environment.size()));
+  std::ranges::for_each(plan.vec_environment, [&](auto&& e){ write(data, e); });
+  write(data, static_cast<uint32_t>(plan.vec_binds.size()));
+  std::ranges::for_each(plan.vec_binds, [&](auto&& e){ std::ranges::for_each(e, [&](auto&& f){ write(data, f); }); });
+  return data;
+} // fn: serialize() }}}
+
+// fn: deserialize() {{{
+inline Plan deserialize(std::string_view data)
+{
+  ethrow_if(not data.starts_with(MAGIC), "Invalid launch plan");
+  Reader reader(data.substr(MAGIC.size()));
+  Plan plan;
+  plan.hash_environment = reader.read<uint64_t>();
+  plan.hash_bindings = reader.read<uint64_t>();
+  for (size_t i = 0, size = reader.read<uint32_t>(); i < size; ++i)
+  {
+    plan.vec_variables.push_back(reader.string());
+  } // for
+  plan.hash_variables = reader.read<uint64_t>();
+  for (size_t i = 0, size = reader.read<uint32_t>(); i < size; ++i)
+  {
+    plan.vec_environment.push_back(reader.entry());
+  } // for
+  for (size_t i = 0, size = reader.read<uint32_t>(); i < size; ++i)
+  {
+    plan.vec_binds.push_back({reader.entry(), reader.entry(), reader.entry()});
+  } // for
+  return plan;
+} // fn: deserialize() }}}
+
+// fn: compile() {{{
+// Reads the configuration json and expands the entries that do not run commands
+inline Plan compile(std::string_view json_environment, std::string_view json_bindings)
+{
+  Plan plan;
+  plan.hash_environment = hash(json_environment);
+  plan.hash_bindings = hash(json_bindings);
+  std::set<std::string> set_variables{"HOME"};
+  auto f_entry = [&](std::string const& value)
+  {
+    add_variables(value, set_variables);
+    qreturn_if(is_dynamic(value), Entry{ .is_dynamic = true, .value = value });
+    auto expanded = ns_env::expand(value);
+    elog_if(not expanded, "Failed to expand '{}': {}"_fmt(value, expanded.error()));
+    return Entry{ .is_dynamic = false, .value = expanded.value_or(value) };
+  };
+  // Environment
+  ns_exception::ignore([&]
+  {
+    qreturn_if(json_environment.empty());
+    std::ranges::transform(ns_db::DbView(json_environment).as_vector(), std::back_inserter(plan.vec_environment), f_entry);
+  });
+  // Bindings, the type is not expanded
+  ns_exception::ignore([&]
+  {
+    qreturn_if(json_bindings.empty());
+    ns_db::DbView(json_bindings).for_each_item([&](auto&&, ns_db::DbView const& binding)
+    {
+      plan.vec_binds.push_back({Entry{ .is_dynamic = false, .value = binding["type"].as_string() }
+        , f_entry(binding["src"].as_string())
+        , f_entry(binding["dst"].as_string())
+      });
+    });
+  });
+  plan.vec_variables.assign(set_variables.begin(), set_variables.end());
+  plan.hash_variables = hash_variables(plan.vec_variables);
+  return plan;
+} // fn: compile() }}}
+
+// fn: resolve() {{{
+// Expands a dynamic entry, keeps the original value if that fails
+inline std::string resolve(Entry const& entry)
+{
+  qreturn_if(not entry.is_dynamic, entry.value);
+  auto expanded = ns_env::expand(entry.value);
+  elog_if(not expanded, "Failed to expand '{}': {}"_fmt(entry.value, expanded.error()));
+  return expanded.value_or(entry.value);
+} // fn: resolve() }}}
+
+} // namespace
+
+// struct Bind {{{
+struct Bind
+{
+  // One of 'ro', 'rw' or 'dev'
+  std::string type;
+  std::string src;
+  std::string dst;
+}; // struct Bind }}}
+
+// struct Launch {{{
+// Resolved configuration of a launch
+struct Launch
+{
+  std::vector<std::string> vec_environment;
+  std::vector<Bind> vec_binds;
+}; // struct Launch }}}
+
+// fn: get() {{{
+// Resolves the environment and bindings configuration json, empty if not configured, from the plan
+// in path_file_plan if it is still valid, or from the json, which then replaces the plan
+inline Launch get(fs::path const& path_file_plan
+  , std::string_view json_environment
+  , std::string_view json_bindings)
+{
+  // Load the previous plan
+  auto opt_plan = ns_exception::to_optional([&]
+  {
+    std::ifstream file(path_file_plan, std::ios::binary);
+    dthrow_if(not file.is_open(), "No launch plan");
+    Plan plan = deserialize(ns_string::to_string(file.rdbuf()));
+    dthrow_if(plan.hash_environment != hash(json_environment)
+      or plan.hash_bindings != hash(json_bindings)
+      or plan.hash_variables != hash_variables(plan.vec_variables)
+      , "Stale launch plan"
+    );
+    return plan;
+  });
+  // Compile and save a novel one if not valid
+  if ( not opt_plan )
+  {
+    ns_log::debug()("Compiling launch plan to '{}'", path_file_plan);
+    opt_plan = compile(json_environment, json_bindings);
+    auto expected_write = ns_linux::write_atomic(path_file_plan, serialize(*opt_plan));
+    elog_if(not expected_write, "Could not save launch plan: {}"_fmt(expected_write.error()));
+  } // if
+  // Resolve the dynamic entries
+  Launch launch;
+  std::ranges::transform(opt_plan->vec_environment, std::back_inserter(launch.vec_environment), resolve);
+  std::ranges::transform(opt_plan->vec_binds, std::back_inserter(launch.vec_binds), [](auto&& e)
+  {
+    return Bind{ .type = e[0].value, .src = resolve(e[1]), .dst = resolve(e[2]) };
+  });
+  return launch;
+} // fn: get() }}}
+
+} // namespace ns_config::ns_plan
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,121 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : store
+///
+
+#pragma once
+
+#include <string>
+#include <filesystem>
+
+#include "../../cpp/lib/db.hpp"
+#include "../../cpp/lib/log.hpp"
+#include "../../cpp/lib/reserved/config.hpp"
+#include "config.hpp"
+
+// Configuration store, a json object in the reserved space of the binary with the keys 'boot',
+// 'environment', 'bindings' and 'casefold'. It is read and written without mounting the
+// filesystems, which are only required once to move the json files of 'fim/config' into it
+
+namespace ns_config::ns_store
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+} // namespace
+
+// fn: read() {{{
+// Configuration json, empty if it was not yet moved to the binary, throws if it is damaged
+inline std::string read(FlatimageConfig const& config)
+{
+  auto expected = ns_reserved::ns_config::read(config.path_file_binary, config.offset_reserved);
+  ethrow_if(not expected, "Could not read configuration: {}"_fmt(expected.error()));
+  return *expected;
+} // fn: read() }}}
+
+// fn: write() {{{
+inline void write(FlatimageConfig const& config, std::string_view json)
+{
+  auto error = ns_reserved::ns_config::write(config.path_file_binary, config.offset_reserved, json);
+  ethrow_if(error, "Could not write configuration: {}"_fmt(*error));
+} // fn: write() }}}
+
+// fn: collect() {{{
+// Configuration json from the json files of the mounted filesystem
+inline std::string collect(FlatimageConfig const& config)
+{
+  std::string json = "{";
+  auto f_add = [&](std::string_view key, fs::path const& path_file_config)
+  {
+    ns_exception::ignore([&]
+    {
+      ns_db::DbFile db_file(path_file_config);
+      std::string_view raw = db_file.view().raw();
+      // Files that are not valid json are not moved
+      (void) ns_db::Db(raw);
+      json += "{}\"{}\":{}"_fmt((json.size() > 1)? "," : "", key, raw);
+    });
+  };
+  f_add("boot", config.path_file_config_boot);
+  f_add("environment", config.path_file_config_environment);
+  f_add("bindings", config.path_file_config_bindings);
+  f_add("casefold", config.path_file_config_casefold);
+  json += "}";
+  return json;
+} // fn: collect() }}}
+
+// fn: migrate() {{{
+// Moves the json files of the mounted filesystem to the binary, returns the configuration json
+inline std::string migrate(FlatimageConfig const& config)
+{
+  ns_log::debug()("Moving configuration files to the binary");
+  std::string json = collect(config);
+  write(config, json);
+  return json;
+} // fn: migrate() }}}
+
+// fn: load() {{{
+// Reads the configuration json, moves it from the filesystem if required, which must be mounted.
+// Binaries that cannot be written, e.g., on read-only media, use the json files on each launch.
+// A damaged configuration throws, the json files are older and must not replace it
+inline std::string load(FlatimageConfig const& config)
+{
+  std::string json = read(config);
+  qreturn_if(not json.empty(), json);
+  json = collect(config);
+  // write() logs the failure
+  ns_exception::ignore([&]{ write(config, json); });
+  return json;
+} // fn: load() }}}
+
+// fn: find() {{{
+// Json of the value of key in the configuration json, empty if not present
+inline std::string_view find(std::string_view json, std::string_view key)
+{
+  qreturn_if(json.empty(), {});
+  auto opt_view = ns_db::DbView(json).find(key);
+  return (opt_view)? opt_view->raw() : std::string_view{};
+} // fn: find() }}}
+
+// fn: transaction() {{{
+// Applies f to the configuration and writes it once, nothing is written if f throws. The binary is
+// locked from the read to the write, so concurrent transactions do not lose each other's changes
+template<typename F>
+void transaction(FlatimageConfig const& config, F&& f)
+{
+  auto error = ns_reserved::ns_config::update(config.path_file_binary, config.offset_reserved, [&](std::string json)
+  {
+    ethrow_if(json.empty(), "Configuration was not moved to the binary");
+    ns_db::Db db(std::string_view{json});
+    f(db);
+    return db.dump();
+  });
+  ethrow_if(error, "Could not write configuration: {}"_fmt(*error));
+} // fn: transaction() }}}
+
+} // namespace ns_config::ns_store
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
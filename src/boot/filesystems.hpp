@@ -6,12 +6,13 @@
 #pragma once
 
 #include <memory>
+#include <future>
 #include <fcntl.h>
 
 #include "../cpp/lib/overlayfs.hpp"
-#include "../cpp/lib/squashfs.hpp"
-#include "../cpp/lib/dwarfs.hpp"
+#include "../cpp/lib/layer.hpp"
 #include "../cpp/lib/ciopfs.hpp"
+#include "../cpp/lib/gpu.hpp"
 
 #include "config/config.hpp"
 
@@ -24,21 +25,29 @@ class Filesystems
   private:
     fs::path m_path_dir_mount;
     std::vector<fs::path> m_vec_path_dir_mountpoints;
-    std::vector<std::unique_ptr<ns_dwarfs::Dwarfs>> m_layers;
+    std::vector<ns_layer::Layer> m_layers;
     std::unique_ptr<ns_ciopfs::Ciopfs> m_ciopfs;
     std::unique_ptr<ns_overlayfs::Overlayfs> m_overlayfs;
     std::optional<pid_t> m_opt_pid_janitor;
-    uint64_t mount_dwarfs(fs::path const& path_dir_mount, fs::path const& path_file_binary, uint64_t offset);
+    // Write end of a pipe the janitor polls, it hangs up if this process dies
+    int m_fd_janitor;
+    uint64_t mount_layers(fs::path const& path_dir_mount
+      , fs::path const& path_file_binary
+      , uint64_t offset
+      , uint64_t size_cache
+      , uint32_t workers
+    );
     void mount_ciopfs(fs::path const& path_dir_lower, fs::path const& path_dir_upper);
     void mount_overlayfs(fs::path const& path_dir_layers
       , fs::path const& path_dir_data
       , fs::path const& path_dir_mount
+      , std::optional<fs::path> const& opt_path_dir_gpu
     );
     // In case the parent process fails to clean the mountpoints, this child does it
     void spawn_janitor();
 
   public:
-    Filesystems(ns_config::FlatimageConfig const& config);
+    Filesystems(ns_config::FlatimageConfig const& config, bool is_gpu = false);
     ~Filesystems();
     Filesystems(Filesystems const&) = delete;
     Filesystems(Filesystems&&) = delete;
@@ -47,11 +56,23 @@ class Filesystems
 }; // class Filesystems }}}
 
 // fn: Filesystems::Filesystems {{{
-inline Filesystems::Filesystems(ns_config::FlatimageConfig const& config)
+inline Filesystems::Filesystems(ns_config::FlatimageConfig const& config, bool is_gpu)
   : m_path_dir_mount(config.path_dir_mount)
+  , m_fd_janitor(-1)
 {
+  // Find the host gpu driver files while the layers are mounted
+  std::future<std::vector<ns_gpu::Link>> future_gpu;
+  if ( is_gpu )
+  {
+    future_gpu = std::async(std::launch::async, ns_gpu::manifest, config.path_dir_host_config / "gpu.manifest");
+  } // if
   // Mount compressed layers
-  uint64_t index_fs = mount_dwarfs(config.path_dir_mount_layers, config.path_file_binary, config.offset_filesystem);
+  uint64_t index_fs = mount_layers(config.path_dir_mount_layers
+    , config.path_file_binary
+    , config.offset_filesystem
+    , config.dwarfs_cache_size
+    , config.dwarfs_workers
+  );
   // Check if should mount ciopfs
   if ( ns_env::exists("FIM_CASEFOLD", "1") )
   {
@@ -60,8 +81,28 @@ inline Filesystems::Filesystems(ns_config::FlatimageConfig const& config)
     );
     ns_log::debug()("ciopfs is enabled");
   } // if
+  // Link the gpu driver files in a directory of this instance, stacked above the layers
+  std::optional<fs::path> opt_path_dir_gpu;
+  if ( future_gpu.valid() )
+  {
+    fs::path path_dir_gpu = config.path_dir_mount / "gpu";
+    auto vec_path_dir_shadow = m_vec_path_dir_mountpoints;
+    vec_path_dir_shadow.push_back(config.path_dir_data_overlayfs / "upperdir");
+    std::error_code ec;
+    fs::create_directories(path_dir_gpu, ec);
+    if ( ec ) { ns_log::error()("Could not create gpu directory: {}", ec.message()); }
+    else
+    {
+      ns_gpu::populate(future_gpu.get(), path_dir_gpu, config.path_dir_runtime_host, vec_path_dir_shadow);
+      opt_path_dir_gpu = path_dir_gpu;
+    } // else
+  } // if
   // Mount overlayfs
-  mount_overlayfs(config.path_dir_mount_layers, config.path_dir_data_overlayfs, config.path_dir_mount_overlayfs);
+  mount_overlayfs(config.path_dir_mount_layers
+    , config.path_dir_data_overlayfs
+    , config.path_dir_mount_overlayfs
+    , opt_path_dir_gpu
+  );
   // Spawn janitor
   spawn_janitor();
 } // fn Filesystems::Filesystems }}}
@@ -76,14 +117,15 @@ inline Filesystems::~Filesystems()
     // Wait for janitor to finish execution
     int status;
     waitpid(*m_opt_pid_janitor, &status, 0);
-    dreturn_if(not WIFEXITED(status), "Janitor exited abnormally");
-    int code = WEXITSTATUS(status);
-    dreturn_if(code != 0, "Janitor exited with code '{}'"_fmt(code));
+    elog_if(not WIFEXITED(status), "Janitor exited abnormally");
+    int code = WIFEXITED(status)? WEXITSTATUS(status) : 0;
+    elog_if(code != 0, "Janitor exited with code '{}'"_fmt(code));
   } // if
   else
   {
     ns_log::error()("Janitor is not running");
   } // else
+  if ( m_fd_janitor >= 0 ) { close(m_fd_janitor); }
 } // fn Filesystems::Filesystems }}}
 
 // fn: spawn_janitor {{{
@@ -92,13 +134,27 @@ inline void Filesystems::spawn_janitor()
   // Find janitor binary
   fs::path path_file_janitor = fs::path{ns_env::get_or_throw("FIM_DIR_APP_BIN")} / "janitor";
 
+  // Pipe to notify the janitor when this process exits, the janitor keeps the read end
+  int fds_pipe[2];
+  ethrow_if(pipe2(fds_pipe, O_CLOEXEC) < 0, "Failed to create janitor pipe: {}"_fmt(strerror(errno)));
+
   // Fork and execve into the janitor process
   pid_t pid_parent = getpid();
   m_opt_pid_janitor = fork();
   ethrow_if(m_opt_pid_janitor < 0, "Failed to fork janitor");
 
   // Is parent
-  dreturn_if(m_opt_pid_janitor > 0, "Spawned janitor with PID '{}'"_fmt(*m_opt_pid_janitor));
+  if ( m_opt_pid_janitor > 0 )
+  {
+    close(fds_pipe[0]);
+    m_fd_janitor = fds_pipe[1];
+    ns_log::debug()("Spawned janitor with PID '{}'", *m_opt_pid_janitor);
+    return;
+  } // if
+
+  // Keep the read end open across execve
+  close(fds_pipe[1]);
+  eabort_if(fcntl(fds_pipe[0], F_SETFD, 0) < 0, "Failed to share janitor pipe");
 
   // Redirect stdout/stderr to a log file
   fs::path path_stdout = std::string{ns_env::get_or_throw("FIM_DIR_MOUNT")} + ".janitor.stdout.log";
@@ -113,12 +169,13 @@ inline void Filesystems::spawn_janitor()
   close(fd_stderr);
   close(STDIN_FILENO);
 
-  // Keep parent pid in a variable
-  ns_env::set("PID_PARENT", pid_parent, ns_env::Replace::Y);
+  // Keep pipe file descriptor in a variable
+  ns_env::set("FIM_JANITOR_FD", fds_pipe[0], ns_env::Replace::Y);
 
-  // Create args to janitor
+  // Create args to janitor, the parent pid followed by its mountpoints
   std::vector<std::string> vec_argv_custom;
   vec_argv_custom.push_back(path_file_janitor);
+  vec_argv_custom.push_back(std::to_string(pid_parent));
   std::copy(m_vec_path_dir_mountpoints.rbegin(), m_vec_path_dir_mountpoints.rend(), std::back_inserter(vec_argv_custom));
   auto argv_custom = std::make_unique<const char*[]>(vec_argv_custom.size() + 1);
   argv_custom[vec_argv_custom.size()] = nullptr;
@@ -131,65 +188,109 @@ inline void Filesystems::spawn_janitor()
   std::abort();
 } // fn: spawn_janitor }}}
 
-// fn: mount_dwarfs {{{
-inline uint64_t Filesystems::mount_dwarfs(fs::path const& path_dir_mount, fs::path const& path_file_binary, uint64_t offset)
+// fn: mount_layers {{{
+inline uint64_t Filesystems::mount_layers(fs::path const& path_dir_mount
+  , fs::path const& path_file_binary
+  , uint64_t offset
+  , uint64_t size_cache
+  , uint32_t workers)
 {
   // Open the main binary
   std::ifstream file_binary(path_file_binary, std::ios::binary);
+  uint64_t size_binary = fs::file_size(path_file_binary);
 
-  // Filesystem index
-  uint64_t index_fs{};
+  // Format, offset and size of each filesystem
+  std::vector<std::tuple<ns_layer::Format,uint64_t,uint64_t>> vec_filesystems;
 
   // Advance offset
   file_binary.seekg(offset);
 
   while (true)
   {
+    // Filesystem index
+    uint64_t index_fs = vec_filesystems.size();
+
     // Read filesystem size
     int64_t size_fs;
     dbreak_if(not file_binary.read(reinterpret_cast<char*>(&size_fs), sizeof(size_fs)), "Stopped reading at index {}"_fmt(index_fs));
     ns_log::debug()("Filesystem size is '{}'", size_fs);
     offset += 8;
 
-    // Check if filesystem is of type 'DWARFS'
-    ebreak_if(not ns_dwarfs::is_dwarfs(path_file_binary, offset), "Invalid dwarfs filesystem appended on the image");
+    // Check if the layer was published and is complete
+    ebreak_if(size_fs <= 0 or static_cast<uint64_t>(size_fs) > size_binary - offset
+      , "Incomplete filesystem at index {}"_fmt(index_fs)
+    );
+
+    // Detect filesystem type
+    auto opt_format = ns_layer::detect(path_file_binary, offset);
+    ebreak_if(not opt_format, "Invalid filesystem appended on the image");
+    ns_log::debug()("Filesystem type is '{}'", ns_layer::to_string(*opt_format));
 
+    // Include filesystem
+    vec_filesystems.push_back({*opt_format, offset, size_fs});
+
+    // Go to next filesystem if exists
+    offset += size_fs;
+    file_binary.seekg(offset);
+  } // while
+
+  // Split the cache and worker budgets between the dwarfs layers, each process needs at least one
+  // worker. A cache smaller than a block evicts on every read, so the cache is split between the
+  // first layers that fit one block each and the remaining layers only get one block
+  uint32_t count_dwarfs = std::max<uint32_t>(std::ranges::count_if(vec_filesystems, [](auto&& e){ return std::get<0>(e) == ns_layer::Format::DWARFS; }), 1);
+  uint32_t count_cached = std::clamp<uint64_t>(size_cache / ns_dwarfs::SIZE_BLOCK, 1, count_dwarfs);
+  uint64_t size_cache_layer = std::max(size_cache / count_cached, ns_dwarfs::SIZE_BLOCK);
+  ns_log::debug()("'{}' dwarfs layers split a cache of '{}' bytes and '{}' workers", count_dwarfs, size_cache, workers);
+  dlog_if(count_cached < count_dwarfs, "'{}' dwarfs layers exceed the cache with one block each"_fmt(count_dwarfs - count_cached));
+
+  for (uint64_t index_fs = 0, index_dwarfs = 0; auto const& [format, offset_fs, size_fs] : vec_filesystems)
+  {
     // Create mountpoint
     fs::path path_dir_mount_index = path_dir_mount / std::to_string(index_fs);
     std::error_code ec;
     fs::create_directories(path_dir_mount_index, ec);
     ebreak_if(ec, "Could not create directories: {}"_fmt(ec.message()));
 
+    // The first layers take the remaining workers
+    uint32_t workers_layer = std::max<uint32_t>(workers / count_dwarfs + ((index_dwarfs < workers % count_dwarfs)? 1 : 0), 1);
+    if ( format == ns_layer::Format::DWARFS ) { index_dwarfs += 1; }
+
     // Mount filesystem
-    ns_log::debug()("Offset to filesystem is '{}'", offset);
-    this->m_layers.emplace_back(std::make_unique<ns_dwarfs::Dwarfs>(path_file_binary
+    ns_log::debug()("Offset to filesystem is '{}'", offset_fs);
+    this->m_layers.emplace_back(ns_layer::mount(format
+      , path_file_binary
       , path_dir_mount_index
-      , offset
+      , offset_fs
       , size_fs
+      , (index_dwarfs <= count_cached)? size_cache_layer : ns_dwarfs::SIZE_BLOCK
+      , workers_layer
       , getpid()
     ));
 
     // Include in mountpoints vector
     m_vec_path_dir_mountpoints.push_back(path_dir_mount_index);
 
-    // Go to next filesystem if exists
     index_fs += 1;
-    offset += size_fs;
-    file_binary.seekg(offset);
-  } // while
+  } // for
+
+  // Wait for all layers at once, they are spawned from this thread since their death signal
+  // is bound to the thread that created them
+  ns_fuse::wait_fuse(m_vec_path_dir_mountpoints);
 
-  return index_fs;
-} // fn: mount_dwarfs }}}
+  return m_layers.size();
+} // fn: mount_layers }}}
 
 // fn: mount_overlayfs {{{
 inline void Filesystems::mount_overlayfs(fs::path const& path_dir_layers
   , fs::path const& path_dir_data
-  , fs::path const& path_dir_mount)
+  , fs::path const& path_dir_mount
+  , std::optional<fs::path> const& opt_path_dir_gpu)
 {
   m_overlayfs = std::make_unique<ns_overlayfs::Overlayfs>(path_dir_layers
     , path_dir_data
     , path_dir_mount
     , getpid()
+    , opt_path_dir_gpu
   );
   m_vec_path_dir_mountpoints.push_back(path_dir_mount);
 } // fn: mount_overlayfs }}}
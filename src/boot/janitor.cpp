@@ -3,10 +3,16 @@
 // @file        : janitor
 ///
 
-#include <thread>
-#include <chrono>
+// Usage: janitor <pid> <mountpoints...>
+// Un-mounts the mountpoints once the process <pid> exits
+
+#include <array>
 #include <filesystem>
 #include <csignal>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 
 #include "../cpp/lib/log.hpp"
 #include "../cpp/lib/env.hpp"
@@ -14,47 +20,80 @@
 #include "../cpp/macro.hpp"
 #include "../cpp/common.hpp"
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 namespace fs = std::filesystem;
 
-std::atomic_bool G_CONTINUE(true);
+// Written to by the signal handler to wake up poll
+int G_PIPE_SIGNAL[2];
 
 void cleanup(int)
 {
-  G_CONTINUE = false;
+  [[maybe_unused]] ssize_t _ = write(G_PIPE_SIGNAL[1], "x", 1);
 } // cleanup
 
 int main(int argc, char const* argv[])
 {
   // Register signal handler
+  ereturn_if(pipe2(G_PIPE_SIGNAL, O_CLOEXEC | O_NONBLOCK) < 0, "Failed to create signal pipe", EXIT_FAILURE);
   signal(SIGTERM, cleanup);
 
   // Initialize logger
   fs::path path_file_log = std::string{ns_env::get_or_throw("FIM_DIR_MOUNT")} + ".janitor.log";
   ns_log::set_sink_file(path_file_log);
 
-  ereturn_if(argc < 2, "Incorrect usage", EXIT_FAILURE);
+  ereturn_if(argc < 3, "Incorrect usage", EXIT_FAILURE);
+
+  // Parent process and its mountpoints
+  pid_t pid_parent = std::stoi(argv[1]);
+  std::vector<fs::path> vec_path_dir_mountpoints(argv+2, argv+argc);
 
-  pid_t pid_parent = std::stoi(ns_env::get_or_throw("PID_PARENT"));
+  // Readable when the parent exits, without pidfd fallback to get a signal when it exits
+  int fd_pid = syscall(SYS_pidfd_open, pid_parent, 0);
+  elog_if(fd_pid < 0 and errno != ESRCH, "pidfd_open is not available: {}"_fmt(strerror(errno)));
+  if ( fd_pid < 0 )
+  {
+    elog_if(prctl(PR_SET_PDEATHSIG, SIGTERM) < 0, "Failed to set parent death signal: {}"_fmt(strerror(errno)));
+  } // if
+
+  // The write end of this pipe is held by the parent, it hangs up when the parent exits
+  int fd_pipe_parent = std::stoi(ns_env::get_or_else("FIM_JANITOR_FD", "-1"));
 
   // Create a novel session for the child process
   pid_t pid_session = setsid();
   ereturn_if(pid_session < 0, "Failed to create a novel session for janitor", EXIT_FAILURE);
   ns_log::info()("Session id is '{}'", pid_session);
 
-  // Wait for parent process to exit
-  while ( kill(pid_parent, 0) == 0 and G_CONTINUE )
+  // Wait for the parent process to exit
+  while ( true )
   {
-    using namespace std::chrono_literals;
-    std::this_thread::sleep_for(100ms);
+    // Wake up on signals, parent exit, and parent hang-up
+    std::array<pollfd,3> arr_pollfd
+    {
+        pollfd{ .fd = G_PIPE_SIGNAL[0], .events = POLLIN, .revents = 0 }
+      , pollfd{ .fd = fd_pipe_parent, .events = POLLIN, .revents = 0 }
+      , pollfd{ .fd = fd_pid, .events = POLLIN, .revents = 0 }
+    };
+    // Without a pidfd nor a pipe, the parent is checked once a second
+    bool is_polling = fd_pid < 0 and fd_pipe_parent < 0;
+    int ret = poll(arr_pollfd.data(), arr_pollfd.size(), (is_polling)? 1000 : -1);
+    qcontinue_if(ret < 0 and errno == EINTR);
+    ebreak_if(ret < 0, "Failed to poll: {}"_fmt(strerror(errno)));
+    // Stop on SIGTERM
+    dbreak_if(arr_pollfd[0].revents != 0, "Received SIGTERM");
+    // Parent process hang-up or exit
+    dbreak_if(arr_pollfd[1].revents != 0 or arr_pollfd[2].revents != 0
+      , "Process with pid '{}' finished"_fmt(pid_parent)
+    );
+    dbreak_if(is_polling and kill(pid_parent, 0) < 0 and errno == ESRCH
+      , "Process with pid '{}' finished"_fmt(pid_parent)
+    );
   } // while
-  ns_log::info()("Parent process with pid '{}' finished", pid_parent);
 
   // Cleanup mountpoints
-  for (auto&& path_dir_mountpoint : std::vector<fs::path>(argv+1, argv+argc))
-  {
-    ns_log::info()("Un-mount '{}'", path_dir_mountpoint);
-    ns_fuse::unmount(path_dir_mountpoint);
-  } // for
+  ns_fuse::unmount(vec_path_dir_mountpoints);
 
   // Exit child
   exit(0);
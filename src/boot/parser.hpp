@@ -8,6 +8,7 @@
 
 #include <set>
 #include <string>
+#include <future>
 #include <expected>
 
 #include "../cpp/std/enum.hpp"
@@ -19,11 +20,14 @@
 #include "../cpp/macro.hpp"
 
 #include "config/environment.hpp"
+#include "config/plan.hpp"
+#include "config/store.hpp"
 #include "config/config.hpp"
 #include "cmd/layers.hpp"
 #include "cmd/desktop.hpp"
 #include "cmd/bind.hpp"
 #include "cmd/help.hpp"
+#include "cmd/gc.hpp"
 #include "filesystems.hpp"
 
 namespace ns_parser
@@ -82,6 +86,7 @@ struct CmdLayer
 {
   CmdLayerOp op;
   std::vector<std::string> args;
+  ns_layer::Format format = ns_layer::Format::DWARFS;
 };
 
 struct CmdCommit
@@ -100,6 +105,10 @@ struct CmdCaseFold
   CmdCaseFoldOp op;
 };
 
+struct CmdGc
+{
+};
+
 struct CmdNone {};
 
 using CmdType = std::variant<CmdRoot
@@ -113,6 +122,7 @@ using CmdType = std::variant<CmdRoot
   , CmdNotify
   , CmdCaseFold
   , CmdBoot
+  , CmdGc
   , CmdNone
 >;
 // }}}
@@ -218,8 +228,17 @@ inline std::expected<CmdType, std::string> parse(int argc , char** argv)
       } // if
       else
       {
-        f_error(argc < 5, ns_cmd::ns_help::layer_usage(), "add requires exactly two arguments");
+        f_error(argc < 5, ns_cmd::ns_help::layer_usage(), "create requires at least two arguments");
         ns_vector::push_back(cmd.args, argv[3], argv[4]);
+        // Optional filesystem format
+        if ( argc > 5 )
+        {
+          f_error(argc != 7 or std::string_view{argv[5]} != "--format"
+            , ns_cmd::ns_help::layer_usage()
+            , "Invalid arguments for create"
+          );
+          cmd.format = ns_layer::from_string(argv[6]);
+        } // if
       } // else
       return CmdType(cmd);
     },
@@ -274,6 +293,12 @@ inline std::expected<CmdType, std::string> parse(int argc , char** argv)
       f_error(argc < 3, ns_cmd::ns_help::boot_usage(), "Incorrect number of arguments");
       return CmdType(CmdBoot(argv[2], (argc > 3)? VecArgs(argv+3, argv+argc) : VecArgs{}));
     },
+    // Remove data left behind by instances that are no longer running
+    ns_match::equal("fim-gc") >>= [&]
+    {
+      f_error(argc != 2, ns_cmd::ns_help::gc_usage(), "Incorrect number of arguments");
+      return CmdType(CmdGc{});
+    },
     // Use the default startup command
     ns_match::equal("fim-help") >>= [&]
     {
@@ -289,7 +314,8 @@ inline std::expected<CmdType, std::string> parse(int argc , char** argv)
         ns_match::equal("commit")   >>= [&]{ f_error(true, ns_cmd::ns_help::commit_usage(), ""); },
         ns_match::equal("notify")   >>= [&]{ f_error(true, ns_cmd::ns_help::notify_usage(), ""); },
         ns_match::equal("casefold") >>= [&]{ f_error(true, ns_cmd::ns_help::casefold_usage(), ""); },
-        ns_match::equal("boot")     >>= [&]{ f_error(true, ns_cmd::ns_help::boot_usage(), ""); }
+        ns_match::equal("boot")     >>= [&]{ f_error(true, ns_cmd::ns_help::boot_usage(), ""); },
+        ns_match::equal("gc")       >>= [&]{ f_error(true, ns_cmd::ns_help::gc_usage(), ""); }
       );
       return CmdType(CmdNone{});
     }
@@ -303,40 +329,70 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
   auto variant_cmd = ns_parser::parse(argc, argv);
 
   // Initialize permissions
-  ns_bwrap::ns_permissions::Permissions permissions(config.path_file_binary
-    , config.offset_permissions.offset
-    , config.offset_permissions.size
-  );
+  ns_bwrap::ns_permissions::Permissions permissions(config.path_file_binary, config.offset_reserved);
+
+  // The gpu driver files are linked when the filesystems are mounted
+  auto f_is_gpu = [&]
+  {
+    auto bits_permissions = permissions.get();
+    return bits_permissions and bits_permissions->gpu;
+  };
+
+  // Result of the bwrap probe, reused across launches
+  fs::path path_file_bwrap_probe = config.path_dir_host_config / "bwrap.probe.json";
 
   auto f_bwrap = [&](std::string const& program
     , std::vector<std::string> const& args
-    , std::vector<std::string> const& environment)
+    , std::future<std::expected<fs::path,std::string>>& future_bwrap)
   {
+    // Resolve the configured environment and bindings
+    std::string json_store = ns_config::ns_store::load(config);
+    auto launch = ns_config::ns_plan::get(config.path_dir_host_config / "launch.plan"
+      , ns_config::ns_store::find(json_store, "environment")
+      , ns_config::ns_store::find(json_store, "bindings")
+    );
+
     // Read permissions
     auto bits_permissions = permissions.get();
     ereturn_if(not bits_permissions, bits_permissions.error());
 
+    // Wait for the bwrap probe
+    auto expected_path_file_bwrap = future_bwrap.get();
+    ereturn_if(not expected_path_file_bwrap, expected_path_file_bwrap.error());
+
     // Create bwrap instance
     ns_bwrap::Bwrap bwrap = ns_bwrap::Bwrap(config.is_root
       , config.path_dir_mount_overlayfs
       , config.path_file_bashrc
       , program
       , args
-      , environment);
+      , launch.vec_environment);
 
     // Include root binding and custom user-defined bindings
-    (void) bwrap
-      .with_bind_ro("/", config.path_dir_runtime_host)
-      .with_binds_from_file(config.path_file_config_bindings);
+    (void) bwrap.with_bind_ro("/", config.path_dir_runtime_host);
+    for (auto&& bind : launch.vec_binds)
+    {
+      ns_exception::ignore([&]{ (void) bwrap.with_bind_try(bind.type, bind.src, bind.dst); });
+    } // for
 
     // Check if should enable GPU
     if ( bits_permissions->gpu )
     {
-      (void) bwrap.with_bind_gpu(config.path_dir_mount_overlayfs, config.path_dir_runtime_host);
+      (void) bwrap.with_bind_gpu();
     }
 
-    // Run bwrap
-    bwrap.run(*bits_permissions);
+    // Run bwrap, probe again on the next launch if it could not create the sandbox
+    auto status = bwrap.run(*bits_permissions, *expected_path_file_bwrap);
+    if ( not status.is_started ) { ns_bwrap::invalidate(path_file_bwrap_probe); }
+  };
+
+  // The configuration commands only mount the filesystems once, to move the configuration files
+  // to the binary
+  auto f_store_migrate = [&]
+  {
+    qreturn_if(not ns_config::ns_store::read(config).empty());
+    [[maybe_unused]] auto mount = ns_filesystems::Filesystems(config);
+    ns_config::ns_store::migrate(config);
   };
 
   // Define logger verbosity for all commands except the ones below
@@ -350,21 +406,23 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
   // Execute a command as a regular user
   if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdExec>(*variant_cmd) )
   {
+    // Probe bwrap while the filesystems are mounted
+    auto future_bwrap = std::async(std::launch::async, ns_bwrap::find_and_setup, path_file_bwrap_probe);
     // Mount filesystem as RO
-    auto mount = ns_filesystems::Filesystems(config);
+    auto mount = ns_filesystems::Filesystems(config, f_is_gpu());
     // Execute specified command
-    auto environment = ns_exception::or_default([&]{ return ns_config::ns_environment::get(config.path_file_config_environment); });
-    f_bwrap(cmd->program, cmd->args, environment);
+    f_bwrap(cmd->program, cmd->args, future_bwrap);
   } // if
   // Execute a command as root
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdRoot>(*variant_cmd) )
   {
+    // Probe bwrap while the filesystems are mounted
+    auto future_bwrap = std::async(std::launch::async, ns_bwrap::find_and_setup, path_file_bwrap_probe);
     // Mount filesystem as RO
-    auto mount = ns_filesystems::Filesystems(config);
+    auto mount = ns_filesystems::Filesystems(config, f_is_gpu());
     // Execute specified command as 'root'
     config.is_root = true;
-    auto environment = ns_exception::or_default([&]{ return ns_config::ns_environment::get(config.path_file_config_environment); });
-    f_bwrap(cmd->program, cmd->args, environment);
+    f_bwrap(cmd->program, cmd->args, future_bwrap);
   } // if
   // Configure permissions
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdPerms>(*variant_cmd) )
@@ -382,18 +440,29 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
   // Configure environment
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdEnv>(*variant_cmd) )
   {
-    // Mount filesystem as RW
-    [[maybe_unused]] auto mount = ns_filesystems::Filesystems(config);
-    // Create config dir if not exists
-    fs::create_directories(config.path_file_config_environment.parent_path());
+    f_store_migrate();
     // Determine open mode
+    auto f_environment = [&](auto&& f)
+    {
+      ns_config::ns_store::transaction(config, [&](auto& db)
+      {
+        auto db_environment = db("environment");
+        f(db_environment, cmd->environment);
+      });
+    };
     switch( cmd->op )
     {
-      case ns_parser::CmdEnvOp::ADD: ns_config::ns_environment::add(config.path_file_config_environment, cmd->environment); break;
-      case ns_parser::CmdEnvOp::SET: ns_config::ns_environment::set(config.path_file_config_environment, cmd->environment); break;
-      case ns_parser::CmdEnvOp::DEL: ns_config::ns_environment::del(config.path_file_config_environment, cmd->environment); break;
+      case ns_parser::CmdEnvOp::ADD: f_environment(ns_config::ns_environment::add); break;
+      case ns_parser::CmdEnvOp::SET: f_environment(ns_config::ns_environment::set); break;
+      case ns_parser::CmdEnvOp::DEL: f_environment(ns_config::ns_environment::del); break;
       case ns_parser::CmdEnvOp::LIST:
-        std::ranges::for_each(ns_config::ns_environment::get(config.path_file_config_environment), ns_functional::PrintLn{}); break;
+      {
+        std::string json_store = ns_config::ns_store::read(config);
+        std::ranges::for_each(ns_config::ns_environment::get(ns_config::ns_store::find(json_store, "environment"))
+          , ns_functional::PrintLn{}
+        );
+      }
+      break;
     } // switch
   } // if
   // Configure desktop integration
@@ -423,25 +492,33 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
   {
     if ( cmd->op == CmdLayerOp::ADD )
     {
-      ns_layers::add(config.path_file_binary, cmd->args.front());
+      ns_layers::add(config.path_file_binary, config.offset_filesystem, cmd->args.front());
     } // if
     else
     {
-      ns_layers::create(cmd->args.at(0), cmd->args.at(1), config.layer_compression_level);
+      ns_layers::create(cmd->args.at(0), cmd->args.at(1), config.layer_compression_level, cmd->format);
     } // else
   } // else if
   // Bind a device or file to the flatimage
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_cmd::ns_bind::CmdBind>(*variant_cmd) )
   {
-    // Mount filesystem as RW
-    [[maybe_unused]] auto mount = ns_filesystems::Filesystems(config);
+    f_store_migrate();
 
     // Perform selected op
+    auto f_bindings = [&](auto&& f)
+    {
+      ns_config::ns_store::transaction(config, [&](auto& db)
+      {
+        auto db_bindings = db("bindings");
+        f(db_bindings, *cmd);
+      });
+    };
     switch(cmd->op)
     {
-      case ns_cmd::ns_bind::CmdBindOp::ADD: ns_cmd::ns_bind::add(config.path_file_config_bindings, *cmd); break;
-      case ns_cmd::ns_bind::CmdBindOp::DEL: ns_cmd::ns_bind::del(config.path_file_config_bindings, *cmd); break;
-      case ns_cmd::ns_bind::CmdBindOp::LIST: ns_cmd::ns_bind::list(config.path_file_config_bindings); break;
+      case ns_cmd::ns_bind::CmdBindOp::ADD: f_bindings(ns_cmd::ns_bind::add); break;
+      case ns_cmd::ns_bind::CmdBindOp::DEL: f_bindings(ns_cmd::ns_bind::del); break;
+      case ns_cmd::ns_bind::CmdBindOp::LIST:
+        ns_cmd::ns_bind::list(ns_config::ns_store::find(ns_config::ns_store::read(config), "bindings")); break;
     } // switch
 
   } // else if
@@ -454,7 +531,7 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
     // Create filesystem based on the contents of src
     ns_layers::create(path_dir_src, path_file_layer, config.layer_compression_level);
     // Include filesystem in the image
-    ns_layers::add(config.path_file_binary, path_file_layer);
+    ns_layers::add(config.path_file_binary, config.offset_filesystem, path_file_layer);
     // Remove compressed filesystem
     fs::remove(path_file_layer);
     // Remove upper directory
@@ -462,57 +539,65 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
   } // else if
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdNotify>(*variant_cmd) )
   {
-    ns_reserved::ns_notify::write(config.path_file_binary
-      , config.offset_notify.offset
-      ,  config.offset_notify.size
+    auto error = ns_reserved::ns_notify::write(config.path_file_binary
+      , config.offset_reserved
       , (cmd->op == CmdNotifyOp::ON)? 1 : 0
     );
+    ereturn_if(error, "Could not write notify byte: {}"_fmt(*error), EXIT_FAILURE);
   } // else if
   // Enable or disable casefold (useful for wine)
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdCaseFold>(*variant_cmd) )
   {
-    [[maybe_unused]] auto mount = ns_filesystems::Filesystems(config);
-    ns_db::from_file(config.path_file_config_casefold, [&](auto& db)
+    f_store_migrate();
+    ns_config::ns_store::transaction(config, [&](auto& db)
     {
-      db("enable") = std::string{cmd->op};
-    }, ns_db::Mode::UPDATE_OR_CREATE);
+      db("casefold")("enable") = std::string{cmd->op};
+    });
   } // else if
   // Update default command on database
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdBoot>(*variant_cmd) )
   {
-    // Mount filesystem as RW
-    [[maybe_unused]] auto mount = ns_filesystems::Filesystems(config);
+    f_store_migrate();
     // Update database
-    ns_db::from_file(config.path_file_config_boot, [&](auto& db)
+    ns_config::ns_store::transaction(config, [&](auto& db)
     {
-      db("program") = cmd->program;
-      db("args") = cmd->args;
-    }, ns_db::Mode::UPDATE_OR_CREATE);
+      db("boot")("program") = cmd->program;
+      db("boot")("args") = cmd->args;
+    });
+  } // else if
+  // Remove stale instances
+  else if ( ns_variant::get_if_holds_alternative<ns_parser::CmdGc>(*variant_cmd) )
+  {
+    println("Removed {} stale instances", ns_cmd::ns_gc::gc(config.path_dir_global));
   } // else if
   // Update default command on database
   else if ( auto cmd = ns_variant::get_if_holds_alternative<ns_parser::CmdNone>(*variant_cmd) )
   {
+    // Probe bwrap while the filesystems are mounted
+    auto future_bwrap = std::async(std::launch::async, ns_bwrap::find_and_setup, path_file_bwrap_probe);
+    // The default command is read from the binary, the filesystems are only required to move the
+    // configuration files to it
+    std::string json_store = ns_config::ns_store::read(config);
     // Mount filesystem as RO
-    auto mount = ns_filesystems::Filesystems(config);
+    auto mount = ns_filesystems::Filesystems(config, f_is_gpu());
+    if ( json_store.empty() ) { json_store = ns_config::ns_store::load(config); }
     // Build exec command
     ns_parser::CmdExec cmd_exec;
     // Fetch default command from database or fallback to bash
     ns_exception::or_else([&]
     {
-      ns_db::from_file(config.path_file_config_boot, [&](auto& db)
+      ns_db::DbView db = ns_db::DbView(json_store)["boot"];
+      cmd_exec.program = db["program"].as_string();
+      cmd_exec.args = db["args"].as_vector();
+      // Expand 'program'
+      if ( auto expected = ns_env::expand(cmd_exec.program) )
       {
-        cmd_exec.program = db["program"];
-        cmd_exec.args = db["args"].as_vector();
-        // Expand 'program'
-        if ( auto expected = ns_env::expand(cmd_exec.program) )
-        {
-          cmd_exec.program = *expected;
-        } // if
-        else
-        {
-          ns_log::error()("Failed to expand 'program': {}", expected.error());
-        } // else
-      }, ns_db::Mode::UPDATE_OR_CREATE);
+        cmd_exec.program = *expected;
+      } // if
+      else
+      {
+        ns_log::error()("Failed to expand 'program': {}", expected.error());
+      } // else
     }, [&]
     {
       cmd_exec.program = "bash";
@@ -521,8 +606,7 @@ inline int parse_cmds(ns_config::FlatimageConfig config, int argc, char** argv)
     // Append argv args
     if ( argc > 1 ) { std::for_each(argv+1, argv+argc, [&](auto&& e){ cmd_exec.args.push_back(e); }); } // if
     // Execute default command
-    auto environment = ns_exception::or_default([&]{ return ns_config::ns_environment::get(config.path_file_config_environment); });
-    f_bwrap(cmd_exec.program, cmd_exec.args, environment);
+    f_bwrap(cmd_exec.program, cmd_exec.args, future_bwrap);
   } // else if
 
   return EXIT_SUCCESS;
@@ -26,10 +26,10 @@ struct Portal
   fs::path m_path_file_daemon;
   fs::path m_path_file_guest;
 
-  Portal(fs::path const& path_file_reference)
+  Portal(fs::path const& path_file_socket)
   {
-    // This is read by the guest to send commands to the daemon
-    ns_env::set("FIM_PORTAL_FILE", path_file_reference, ns_env::Replace::Y);
+    // This is read by the guest to connect to the daemon
+    ns_env::set("FIM_PORTAL_SOCKET", path_file_socket, ns_env::Replace::Y);
 
     // Path to flatimage binaries
     const char* str_dir_app_bin = ns_env::get("FIM_DIR_APP_BIN");
@@ -41,13 +41,13 @@ struct Portal
     ethrow_if(not fs::exists(m_path_file_daemon), "Daemon not found in {}"_fmt(m_path_file_daemon));
     ethrow_if(not fs::exists(m_path_file_guest), "Guest not found in {}"_fmt(m_path_file_guest));
 
-    // Create a portal that uses the reference file to create an unique communication key
+    // Create a portal that listens on the socket file
     m_process = std::make_unique<ns_subprocess::Subprocess>(m_path_file_daemon);
 
     // Spawn process to background
     (void) m_process->with_piped_outputs()
       .with_die_on_pid(getpid())
-      .with_args(path_file_reference)
+      .with_args(path_file_socket)
       .spawn();
   } // Portal
 
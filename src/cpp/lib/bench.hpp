@@ -0,0 +1,63 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : bench
+///
+
+#pragma once
+
+#include <chrono>
+#include <format>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../macro.hpp"
+
+// Helpers of the benchmark programs, timing, percentiles and formatting of results
+
+namespace ns_bench
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Units of since()
+using Seconds = std::chrono::duration<double>;
+using Milliseconds = std::chrono::duration<double,std::milli>;
+using Microseconds = std::chrono::duration<double,std::micro>;
+
+// fn: since() {{{
+// Time elapsed from time_start, in the unit of Duration
+template<typename Duration = Seconds>
+inline double since(Clock::time_point time_start)
+{
+  return std::chrono::duration_cast<Duration>(Clock::now() - time_start).count();
+} // fn: since() }}}
+
+// fn: percentile() {{{
+// Value below which a fraction p of the values fall
+inline double percentile(std::vector<double> vec_values, double p)
+{
+  qreturn_if(vec_values.empty(), 0);
+  std::ranges::sort(vec_values);
+  size_t index = std::min(vec_values.size() - 1, static_cast<size_t>(p * vec_values.size()));
+  return vec_values[index];
+} // fn: percentile() }}}
+
+// fn: fixed() {{{
+// Value with precision decimal places, println formats its arguments as strings and does not
+// take a precision
+inline std::string fixed(double value, int precision)
+{
+  return std::format("{:.{}f}", value, precision);
+} // fn: fixed() }}}
+
+// fn: rate() {{{
+// Count per second, zero if no time elapsed
+inline double rate(double count, double seconds)
+{
+  return (seconds > 0)? count / seconds : 0;
+} // fn: rate() }}}
+
+} // namespace ns_bench
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -6,9 +6,14 @@
 #pragma once
 
 #include <filesystem>
+#include <fstream>
+#include <array>
 #include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pwd.h>
-#include <regex>
 
 #include "../std/vector.hpp"
 #include "../std/functional.hpp"
@@ -17,6 +22,7 @@
 #include "db.hpp"
 #include "match.hpp"
 #include "subprocess.hpp"
+#include "environment.hpp"
 #include "env.hpp"
 #include "reserved/permissions.hpp"
 
@@ -28,7 +34,73 @@ namespace
 
 namespace fs = std::filesystem;
 
-}
+// fn: hash_file() {{{
+// FNV-1a of the contents of a file
+inline std::optional<uint64_t> hash_file(fs::path const& path_file)
+{
+  std::ifstream file(path_file, std::ios::binary);
+  qreturn_if(not file.is_open(), std::nullopt);
+  uint64_t hash = 14695981039346656037ull;
+  std::array<char,65536> buffer;
+  while ( file.read(buffer.data(), buffer.size()) or file.gcount() > 0 )
+  {
+    for (std::streamsize i = 0; i < file.gcount(); ++i)
+    {
+      hash = (hash ^ static_cast<uint8_t>(buffer[i])) * 1099511628211ull;
+    } // for
+  } // while
+  return hash;
+} // fn: hash_file() }}}
+
+// fn: probe_key() {{{
+// Identifies the conditions a bwrap probe depends on: the kernel, the bwrap binary and the
+// apparmor restriction of unprivileged user namespaces with the flatimage profile
+inline std::optional<std::string> probe_key(fs::path const& path_file_bwrap)
+{
+  utsname uts;
+  qreturn_if(uname(&uts) < 0, std::nullopt);
+  auto opt_hash = hash_file(path_file_bwrap);
+  qreturn_if(not opt_hash, std::nullopt);
+  std::string str_apparmor = "none";
+  if ( std::ifstream file{"/proc/sys/kernel/apparmor_restrict_unprivileged_userns"}; file.is_open() )
+  {
+    std::getline(file, str_apparmor);
+  } // if
+  bool is_profile = fs::exists("/etc/apparmor.d/flatimage");
+  return "{}:{:016x}:{}:{}"_fmt(uts.release, *opt_hash, str_apparmor, is_profile);
+} // fn: probe_key() }}}
+
+// fn: write_args() {{{
+// Writes args as '\0'-terminated strings to a memfd for bwrap '--args', the file descriptor is
+// close-on-exec and only bwrap inherits it, which reads it before parsing the rest of its arguments
+inline std::expected<int, std::string> write_args(std::vector<std::string> const& args)
+{
+  std::string data;
+  std::ranges::for_each(args, [&](auto&& e){ data.append(e); data.push_back('\0'); });
+  int fd = memfd_create("fim-bwrap-args", MFD_CLOEXEC);
+  qreturn_if(fd < 0, std::unexpected("Could not create memfd: {}"_fmt(strerror(errno))));
+  for (size_t offset = 0; offset < data.size();)
+  {
+    ssize_t count = write(fd, data.data() + offset, data.size() - offset);
+    qcontinue_if(count < 0 and errno == EINTR);
+    if ( count <= 0 )
+    {
+      std::string error = strerror(errno);
+      close(fd);
+      return std::unexpected("Could not write bwrap arguments: {}"_fmt(error));
+    } // if
+    offset += count;
+  } // for
+  if ( lseek(fd, 0, SEEK_SET) < 0 )
+  {
+    std::string error = strerror(errno);
+    close(fd);
+    return std::unexpected("Could not rewind bwrap arguments: {}"_fmt(error));
+  } // if
+  return fd;
+} // fn: write_args() }}}
+
+} // namespace
 
 namespace ns_permissions
 {
@@ -38,13 +110,115 @@ using Permissions = ns_reserved::ns_permissions::Permissions;
 
 } // namespace ns_permissions
 
+// test_and_setup() {{{
+// Checks if bwrap works on this system, or sets up an apparmor profile for it. Independent of
+// the mounted filesystems, so it can run while they are mounted
+inline std::expected<fs::path, std::string> test_and_setup(fs::path const& path_file_bwrap_src)
+{
+  // Test current bwrap binary
+  auto ret = ns_subprocess::Subprocess(path_file_bwrap_src)
+    .with_piped_outputs()
+    .with_args("--bind", "/", "/", "bash", "-c", "echo")
+    .spawn()
+    .wait();
+  qreturn_if (ret and *ret == 0, path_file_bwrap_src);
+  // Try to use bwrap installed by flatimage
+  fs::path path_file_bwrap_opt = "/opt/flatimage/bwrap";
+  ret = ns_subprocess::Subprocess(path_file_bwrap_opt)
+    .with_piped_outputs()
+    .with_args("--bind", "/", "/", "bash", "-c", "echo")
+    .spawn()
+    .wait();
+  qreturn_if (ret and *ret == 0, path_file_bwrap_opt);
+  // Error might be EACCES, try to integrate with apparmor
+  auto opt_path_file_pkexec = ns_subprocess::search_path("pkexec");
+  qreturn_if(not opt_path_file_pkexec.has_value(), std::unexpected("Could not find pkexec binary"));
+  auto opt_path_file_bwrap_apparmor = ns_subprocess::search_path("fim_bwrap_apparmor");
+  qreturn_if(not opt_path_file_bwrap_apparmor.has_value(), std::unexpected("Could not find bwrap_apparmor binary"));
+  auto expected_path_dir_mount = ns_exception::to_expected([]{ return ns_env::get_or_throw("FIM_DIR_MOUNT"); });
+  qreturn_if(not expected_path_dir_mount, std::unexpected(expected_path_dir_mount.error()));
+  ret = ns_subprocess::Subprocess(*opt_path_file_pkexec)
+    .with_args(*opt_path_file_bwrap_apparmor, *expected_path_dir_mount, path_file_bwrap_src)
+    .spawn()
+    .wait();
+  qreturn_if(not ret, std::unexpected("Could not find create profile (abnormal exit)"));
+  qreturn_if(ret and *ret != 0, std::unexpected("Could not find create profile with exit code '{}'"_fmt(*ret)));
+  return path_file_bwrap_opt;
+} // test_and_setup() }}}
+
+// find_and_setup() {{{
+// Uses native bwrap if exists, or the builtin one. The probe result is kept in path_file_cache
+// and reused while its key matches, call invalidate() if bwrap fails to start with it
+inline std::expected<fs::path, std::string> find_and_setup(fs::path const& path_file_cache)
+{
+  fs::path path_file_bwrap;
+  if ( const char* entry = ns_env::get("BWRAP_NATIVE") )
+  {
+    path_file_bwrap = entry;
+    ns_log::debug()("Using bwrap native");
+  } // if
+  else
+  {
+    auto opt_path_file_bwrap = ns_subprocess::search_path("bwrap");
+    qreturn_if(not opt_path_file_bwrap.has_value(), std::unexpected("Could not find bwrap"));
+    path_file_bwrap = *opt_path_file_bwrap;
+    ns_log::debug()("Using bwrap builtin");
+  } // else
+  // Check for a previous probe under the same conditions
+  auto opt_key = probe_key(path_file_bwrap);
+  auto opt_path_file_cached = ns_exception::to_optional([&]
+  {
+    ns_db::DbFile db_file(path_file_cache);
+    ns_db::DbView db = db_file.view();
+    dthrow_if(not opt_key or db["key"].as_string() != *opt_key, "Stale bwrap probe");
+    return fs::path{db["bwrap"].as_string()};
+  });
+  if ( opt_path_file_cached and fs::exists(*opt_path_file_cached) )
+  {
+    ns_log::debug()("Using cached bwrap probe '{}'", *opt_path_file_cached);
+    return *opt_path_file_cached;
+  } // if
+  // Probe and save the result, the key is computed again since the setup might create the
+  // apparmor profile
+  auto expected_path_file_bwrap = test_and_setup(path_file_bwrap);
+  qreturn_if(not expected_path_file_bwrap, expected_path_file_bwrap);
+  opt_key = probe_key(path_file_bwrap);
+  qreturn_if(not opt_key, expected_path_file_bwrap);
+  ns_exception::ignore([&]
+  {
+    ns_db::transaction(path_file_cache, [&](auto& db)
+    {
+      db("key") = *opt_key;
+      db("bwrap") = expected_path_file_bwrap->string();
+    }, ns_db::Mode::CREATE);
+  });
+  return expected_path_file_bwrap;
+} // find_and_setup() }}}
+
+// invalidate() {{{
+// Discards the cached probe, so the next launch probes bwrap again
+inline void invalidate(fs::path const& path_file_cache)
+{
+  std::error_code ec;
+  fs::remove(path_file_cache, ec);
+} // invalidate() }}}
+
+// struct Status {{{
+struct Status
+{
+  // Bwrap reported the pid of the sandboxed process, it could create the sandbox
+  bool is_started;
+  // Exit code of bwrap, nullopt if it exited abnormally
+  std::optional<int> opt_code;
+}; // struct Status }}}
+
 class Bwrap
 {
   private:
     // Program to run, its arguments and environment
     fs::path m_path_file_program;
     std::vector<std::string> m_program_args;
-    std::vector<std::string> m_program_env;
+    ns_environment::Environment m_program_env;
 
     // XDG_RUNTIME_DIR
     fs::path m_path_dir_xdg_runtime;
@@ -56,7 +230,6 @@ class Bwrap
     bool m_is_root;
 
     void set_xdg_runtime_dir();
-    std::expected<fs::path, std::string> test_and_setup(fs::path const& path_file_bwrap);
 
   public:
     template<ns_concept::StringRepresentable... Args>
@@ -70,8 +243,7 @@ class Bwrap
     Bwrap(Bwrap&&) = delete;
     Bwrap& operator=(Bwrap const&) = delete;
     Bwrap& operator=(Bwrap&&) = delete;
-    Bwrap& symlink_nvidia(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host);
-    Bwrap& with_binds_from_file(fs::path const& path_file_bindings);
+    Bwrap& with_bind_try(std::string const& type, fs::path const& src, fs::path const& dst);
     Bwrap& bind_home();
     Bwrap& bind_media();
     Bwrap& bind_audio();
@@ -83,10 +255,10 @@ class Bwrap
     Bwrap& bind_input();
     Bwrap& bind_usb();
     Bwrap& bind_network();
-    Bwrap& with_bind_gpu(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host);
+    Bwrap& with_bind_gpu();
     Bwrap& with_bind(fs::path const& src, fs::path const& dst);
     Bwrap& with_bind_ro(fs::path const& src, fs::path const& dst);
-    void run(ns_permissions::PermissionBits const& permissions);
+    [[nodiscard]] Status run(ns_permissions::PermissionBits const& permissions, fs::path const& path_file_bwrap);
 }; // class: Bwrap
 
 // Bwrap() {{{
@@ -103,14 +275,14 @@ inline Bwrap::Bwrap(
   , m_is_root(is_root)
 {
   // Push passed environment
-  std::ranges::for_each(program_env, [&](auto&& e){ ns_log::info()("ENV: {}", e); m_program_env.push_back(e); });
+  std::ranges::for_each(program_env, [&](auto&& e){ ns_log::info()("ENV: {}", e); m_program_env.set(e); });
 
   // Configure some environment variables
-  m_program_env.push_back("TERM=xterm");
+  m_program_env.set("TERM", "xterm");
 
   if ( struct passwd *pw = getpwuid(getuid()); pw )
   {
-    m_program_env.push_back("HOST_USERNAME=pw->pw_name");
+    m_program_env.set("HOST_USERNAME", pw->pw_name);
   } // if
 
   // Setup PS1
@@ -128,7 +300,6 @@ inline Bwrap::Bwrap(
     {
       of << R"(export PS1="[flatimage-${FIM_DIST,,}] \W → ")";
     } // else
-    ns_env::set("BASHRC_FILE", path_file_bashrc.c_str(), ns_env::Replace::Y);
   } // if
   of.close();
 
@@ -155,124 +326,22 @@ inline void Bwrap::set_xdg_runtime_dir()
 {
   m_path_dir_xdg_runtime = ns_env::get_or_else("XDG_RUNTIME_DIR", "/run/user/{}"_fmt(getuid()));
   ns_log::info()("XDG_RUNTIME_DIR: {}", m_path_dir_xdg_runtime);
-  m_program_env.push_back("XDG_RUNTIME_DIR={}"_fmt(m_path_dir_xdg_runtime));
+  m_program_env.set("XDG_RUNTIME_DIR", m_path_dir_xdg_runtime.string());
   ns_vector::push_back(m_args, "--setenv", "XDG_RUNTIME_DIR", m_path_dir_xdg_runtime);
 } // set_xdg_runtime_dir() }}}
 
-// test_and_setup() {{{
-inline std::expected<fs::path, std::string> Bwrap::test_and_setup(fs::path const& path_file_bwrap_src)
-{
-  // Test current bwrap binary
-  auto ret = ns_subprocess::Subprocess(path_file_bwrap_src)
-    .with_piped_outputs()
-    .with_args("--bind", "/", "/", "bash", "-c", "echo")
-    .spawn()
-    .wait();
-  qreturn_if (ret and *ret == 0, path_file_bwrap_src);
-  // Try to use bwrap installed by flatimage
-  fs::path path_file_bwrap_opt = "/opt/flatimage/bwrap";
-  ret = ns_subprocess::Subprocess(path_file_bwrap_opt)
-    .with_piped_outputs()
-    .with_args("--bind", "/", "/", "bash", "-c", "echo")
-    .spawn()
-    .wait();
-  qreturn_if (ret and *ret == 0, path_file_bwrap_opt);
-  // Error might be EACCES, try to integrate with apparmor
-  auto opt_path_file_pkexec = ns_subprocess::search_path("pkexec");
-  qreturn_if(not opt_path_file_pkexec.has_value(), std::unexpected("Could not find pkexec binary"));
-  auto opt_path_file_bwrap_apparmor = ns_subprocess::search_path("fim_bwrap_apparmor");
-  qreturn_if(not opt_path_file_bwrap_apparmor.has_value(), std::unexpected("Could not find bwrap_apparmor binary"));
-  auto expected_path_dir_mount = ns_exception::to_expected([]{ return ns_env::get_or_throw("FIM_DIR_MOUNT"); });
-  qreturn_if(not expected_path_dir_mount, expected_path_dir_mount.error());
-  ret = ns_subprocess::Subprocess(*opt_path_file_pkexec)
-    .with_args(*opt_path_file_bwrap_apparmor, *expected_path_dir_mount, path_file_bwrap_src)
-    .spawn()
-    .wait();
-  qreturn_if(not ret, std::unexpected("Could not find create profile (abnormal exit)"));
-  qreturn_if(ret and *ret != 0, std::unexpected("Could not find create profile with exit code '{}'"_fmt(*ret)));
-  return path_file_bwrap_opt;
-} // test_and_setup() }}}
-
-// symlink_nvidia() {{{
-inline Bwrap& Bwrap::symlink_nvidia(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host)
-{
-  std::regex regex_exclude("gst|icudata|egl-wayland", std::regex_constants::extended);
-
-  auto f_find_and_bind = [&]<typename... Args>(fs::path const& path_dir_search, Args&&... args)
-  {
-    std::vector<std::string_view> keywords{std::forward<Args>(args)...};
-    ireturn_if(not fs::exists(path_dir_search), "Search path does not exist: '{}'"_fmt(path_dir_search));
-    for(auto&& path_file_entry : fs::directory_iterator(path_dir_search) | std::views::transform([](auto&& e){ return e.path(); }))
-    {
-      // Skip ignored matches
-      dcontinue_if(std::regex_search(path_file_entry.c_str(), regex_exclude), "Ignoring match '{}'"_fmt(path_file_entry));
-      // Skip directories
-      qcontinue_if(fs::is_directory(path_file_entry));
-      // Skip files that do not match keywords
-      qcontinue_if(not std::ranges::any_of(keywords, [&](auto&& f){ return path_file_entry.filename().string().contains(f); }));
-      // Symlink target is the file and the end of the symlink chain
-      auto path_file_entry_realpath = ns_filesystem::ns_path::realpath(path_file_entry);
-      econtinue_if(not path_file_entry_realpath, "Broken symlink: '{}'"_fmt(path_file_entry));
-      // Create target and symlink names
-      fs::path path_link_target = path_dir_root_host / path_file_entry_realpath->relative_path();
-      fs::path path_link_name = path_dir_root_guest / path_file_entry.relative_path();
-      // File already exists in the container as a regular file or directory, skip
-      qcontinue_if(fs::exists(path_link_name) and not fs::is_symlink(path_link_name));
-      // Create parent directories
-      std::error_code ec;
-      fs::create_directories(path_link_name.parent_path(), ec);
-      econtinue_if (ec, ec.message());
-      // Remove existing link
-      fs::remove(path_link_name, ec);
-      // Symlink
-      econtinue_if(symlink(path_link_target.c_str(), path_link_name.c_str()) < 0, "{}: {}"_fmt(strerror(errno), path_link_name));
-      // Log symlink successful
-      ns_log::debug()("PERM(NVIDIA): {} -> {}", path_link_name, path_link_target);
-    } // for
-  };
-
-  // Bind files
-  f_find_and_bind("/usr/lib", "nvidia", "cuda", "nvcuvid", "nvoptix");
-  f_find_and_bind("/usr/lib/x86_64-linux-gnu", "nvidia", "cuda", "nvcuvid", "nvoptix");
-  f_find_and_bind("/usr/lib/i386-linux-gnu", "nvidia", "cuda", "nvcuvid", "nvoptix");
-  f_find_and_bind("/usr/bin", "nvidia");
-  f_find_and_bind("/usr/share", "nvidia");
-  f_find_and_bind("/usr/share/vulkan/icd.d", "nvidia");
-  f_find_and_bind("/usr/lib32", "nvidia", "cuda");
-
-  // Bind devices
-  for(auto&& entry : fs::directory_iterator("/dev")
-    | std::views::transform([](auto&& e){ return e.path(); })
-    | std::views::filter([](auto&& e){ return e.filename().string().contains("nvidia"); }))
-  {
-    ns_vector::push_back(m_args, "--dev-bind-try", entry, entry);
-  } // for
-
-  return *this;
-} // symlink_nvidia() }}}
-
-// with_binds_from_file() {{{
-inline Bwrap& Bwrap::with_binds_from_file(fs::path const& path_file_bindings)
+// with_bind_try() {{{
+// Binds src to dst if src exists, type is one of 'ro', 'rw' or 'dev'
+inline Bwrap& Bwrap::with_bind_try(std::string const& type, fs::path const& src, fs::path const& dst)
 {
-  // Load bindings from the filesystem if any
-  ns_exception::ignore([&]
-  {
-    auto db = ns_db::Db(path_file_bindings, ns_db::Mode::READ);
-    for(auto&& key : ns_db::Db(path_file_bindings, ns_db::Mode::READ).keys())
-    {
-      auto const& binding = db[key];
-      m_args.push_back(ns_match::match(std::string{binding["type"]}
-        , ns_match::equal("ro") >>= std::string{"--ro-bind-try"}
-        , ns_match::equal("rw") >>= std::string{"--bind-try"}
-        , ns_match::equal("dev") >>= std::string{"--dev-bind-try"}
-      ));
-      m_args.push_back(ns_env::expand(binding["src"]).value_or(binding["src"]));
-      m_args.push_back(ns_env::expand(binding["dst"]).value_or(binding["dst"]));
-    } // for
-  });
-
+  m_args.push_back(ns_match::match(type
+    , ns_match::equal("ro") >>= std::string{"--ro-bind-try"}
+    , ns_match::equal("rw") >>= std::string{"--bind-try"}
+    , ns_match::equal("dev") >>= std::string{"--dev-bind-try"}
+  ));
+  ns_vector::push_back(m_args, src, dst);
   return *this;
-} // with_binds_from_file() }}}
+} // with_bind_try() }}}
 
 // with_bind() {{{
 inline Bwrap& Bwrap::with_bind(fs::path const& src, fs::path const& dst)
@@ -446,16 +515,25 @@ inline Bwrap& Bwrap::bind_network()
 } // bind_network() }}}
 
 // with_bind_gpu() {{{
-inline Bwrap& Bwrap::with_bind_gpu(fs::path const& path_dir_root_guest, fs::path const& path_dir_root_host)
+// Binds the gpu devices, the driver files are linked by ns_gpu when the filesystems are mounted
+inline Bwrap& Bwrap::with_bind_gpu()
 {
   ns_log::debug()("PERM(GPU)");
   ns_vector::push_back(m_args, "--dev-bind-try", "/dev/dri", "/dev/dri");
-  symlink_nvidia(path_dir_root_guest, path_dir_root_host);
+  std::error_code ec;
+  for(auto&& entry : fs::directory_iterator("/dev", ec)
+    | std::views::transform([](auto&& e){ return e.path(); })
+    | std::views::filter([](auto&& e){ return e.filename().string().contains("nvidia"); }))
+  {
+    ns_vector::push_back(m_args, "--dev-bind-try", entry, entry);
+  } // for
   return *this;
 } // with_bind_gpu() }}}
 
 // run() {{{
-inline void Bwrap::run(ns_permissions::PermissionBits const& permissions)
+// Returns the exit code of bwrap and whether it started the program, the exit code of bwrap is the
+// one of the program so it cannot tell a failed start apart
+inline Status Bwrap::run(ns_permissions::PermissionBits const& permissions, fs::path const& path_file_bwrap)
 {
   // Configure bindings
   ns_functional::call_if(permissions.home        , [&]{ bind_home()        ; });
@@ -470,39 +548,52 @@ inline void Bwrap::run(ns_permissions::PermissionBits const& permissions)
   ns_functional::call_if(permissions.usb         , [&]{ bind_usb()         ; });
   ns_functional::call_if(permissions.network     , [&]{ bind_network()     ; });
 
-  auto opt_path_file_bash = ns_subprocess::search_path("bash");
-  ethrow_if(not opt_path_file_bash.has_value(), "Could not find bash");
+  // Pass the options through a file descriptor, they are not bound by ARG_MAX
+  auto expected_fd_args = write_args(m_args);
+  elog_if(not expected_fd_args, expected_fd_args.error());
+  std::vector<std::string> args = (expected_fd_args)?
+      std::vector<std::string>{"--args", std::to_string(*expected_fd_args)}
+    : m_args;
 
-  // Use builtin bwrap or native if exists
-  fs::path path_file_bwrap;
-  if ( const char* entry = ns_env::get("BWRAP_NATIVE") )
-  {
-    path_file_bwrap = entry;
-    ns_log::debug()("Using bwrap native");
-  } // if
-  else
-  {
-    auto opt_path_file_bwrap = ns_subprocess::search_path("bwrap");
-    ethrow_if(not opt_path_file_bwrap.has_value(), "Could not find bwrap");
-    path_file_bwrap = *opt_path_file_bwrap;
-    ns_log::debug()("Using bwrap builtin");
-  } // else
-
-  // Test bwrap and setup apparmor if it is required
-  auto expected_path_file_bwrap = test_and_setup(path_file_bwrap);
-  ethrow_if(not expected_path_file_bwrap, expected_path_file_bwrap.error());
+  // Bwrap writes the pid of the sandboxed process to the info fd once it is created
+  int fds_info[2];
+  bool is_info = pipe2(fds_info, O_CLOEXEC) == 0;
+  elog_if(not is_info, "Could not create info pipe: {}"_fmt(strerror(errno)));
+  if ( is_info ) { ns_vector::push_back(args, "--info-fd", std::to_string(fds_info[1])); }
 
   // Run Bwrap
-  auto ret = ns_subprocess::Subprocess(*opt_path_file_bash)
-    .with_args("-c", "\"{}\" \"$@\""_fmt(*expected_path_file_bwrap), "--")
-    .with_args(m_args)
+  ns_subprocess::Subprocess subprocess(path_file_bwrap);
+  if ( expected_fd_args ) { (void) subprocess.with_inherit_fd(*expected_fd_args); }
+  if ( is_info ) { (void) subprocess.with_inherit_fd(fds_info[1]); }
+  (void) subprocess
+    .with_args(args)
     .with_args(m_path_file_program)
     .with_args(m_program_args)
     .with_env(m_program_env)
-    .spawn()
-    .wait();
+    .spawn();
+  // Only bwrap holds the arguments after the spawn
+  if ( expected_fd_args ) { close(*expected_fd_args); }
+  if ( is_info ) { close(fds_info[1]); }
+  auto ret = subprocess.wait();
   if ( not ret ) { ns_log::error()("bwrap exited abnormally"); }
-  if ( *ret != 0 ) { ns_log::error()("bwrap exited with non-zero exit code '{}'", *ret); }
+  else if ( *ret != 0 ) { ns_log::error()("bwrap exited with non-zero exit code '{}'", *ret); }
+
+  // Without an info pipe assume a start, so the probe is not discarded on every launch
+  qreturn_if(not is_info, (Status{ .is_started = true, .opt_code = ret }));
+  // The sandboxed process might keep the write end, do not block on it
+  std::string info;
+  std::array<char,4096> buffer;
+  fcntl(fds_info[0], F_SETFL, O_NONBLOCK);
+  for (ssize_t count; (count = read(fds_info[0], buffer.data(), buffer.size())) != 0;)
+  {
+    qcontinue_if(count < 0 and errno == EINTR);
+    qbreak_if(count < 0);
+    info.append(buffer.data(), count);
+  } // for
+  close(fds_info[0]);
+  bool is_started = info.contains("child-pid");
+  elog_if(not is_started, "bwrap did not start the program");
+  return Status{ .is_started = is_started, .opt_code = ret };
 } // run() }}}
 
 } // namespace ns_bwrap
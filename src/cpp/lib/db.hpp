@@ -7,11 +7,15 @@
 
 #include <filesystem>
 #include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
 #include <set>
 #include <variant>
 
 #include "log.hpp"
+#include "linux.hpp"
+#include "db/view.hpp"
 #include "../common.hpp"
 #include "../macro.hpp"
 #include "../std/enum.hpp"
@@ -43,6 +47,10 @@ class Db
     std::variant<json_t, std::reference_wrapper<json_t>> m_json;
     fs::path m_path_file_db;
     Mode m_mode;
+    // Changes are only written by commit(), and discarded if it is not called
+    bool m_is_transaction;
+    // Written by commit(), the destructor does not write it again
+    bool m_is_committed;
 
     Db(std::reference_wrapper<json_t> json);
 
@@ -59,6 +67,10 @@ class Db
     // Destructors
     ~Db();
 
+    // Transactions
+    void begin();
+    void commit();
+
     // Access
     bool is_array() const;
     bool is_object() const;
@@ -101,7 +113,7 @@ class Db
     Db operator=(Db const&) = delete;
     Db operator=(Db&&) = delete;
     template<ns_concept::StringRepresentable T>
-    Db const& operator[](T&& t) const;
+    Db operator[](T&& t) const;
     template<ns_concept::StringRepresentable T>
     Db operator()(T&& t);
     template<typename T>
@@ -111,13 +123,19 @@ class Db
 
 // Constructors {{{
 inline Db::Db(std::reference_wrapper<json_t> json)
+  : m_json(json)
+  , m_path_file_db()
+  , m_mode(Mode::READ)
+  , m_is_transaction(false)
+  , m_is_committed(false)
 {
-  m_json = json;
 } // Json
 
 inline Db::Db(std::string_view json_data)
   : m_path_file_db("/dev/null")
   , m_mode(Mode::READ)
+  , m_is_transaction(false)
+  , m_is_committed(false)
 {
   // Validate contents
   ithrow_if(not json_t::accept(json_data), "Failed to parse json data: '{}'"_fmt(json_data));
@@ -128,6 +146,8 @@ inline Db::Db(std::string_view json_data)
 inline Db::Db(fs::path t, Mode mode)
   : m_path_file_db(t)
   , m_mode(mode)
+  , m_is_transaction(false)
+  , m_is_committed(false)
 {
   ns_log::debug()("Open file '{}' as '{}'", m_path_file_db, mode);
 
@@ -180,17 +200,42 @@ inline Db::Db(fs::path t, Mode mode)
 
 inline Db::~Db()
 {
-  if ( m_mode != Mode::READ and std::holds_alternative<json_t>(m_json) )
+  // An open transaction was not committed, e.g., due to an exception
+  dreturn_if(m_is_transaction, "Discarding changes to '{}'"_fmt(m_path_file_db));
+  if ( m_mode != Mode::READ and not m_is_committed and std::holds_alternative<json_t>(m_json) )
   {
-    std::ofstream file(m_path_file_db, std::ios::trunc);
-    ereturn_if(not file.is_open(), "Failed to open '{}' for writing"_fmt(m_path_file_db));
-    file << std::setw(2) << std::get<json_t>(m_json);
-    file.close();
+    try { commit(); } catch(std::exception const& e) { ns_log::error()(e.what()); }
   } // if
 } // Db
 
 // }}}
 
+// begin() {{{
+// Starts a transaction, changes are kept in memory until commit()
+inline void Db::begin()
+{
+  ethrow_if(m_mode == Mode::READ or not std::holds_alternative<json_t>(m_json)
+    , "Tried to start a transaction on read-only db '{}'"_fmt(m_path_file_db)
+  );
+  m_is_transaction = true;
+  m_is_committed = false;
+} // begin() }}}
+
+// commit() {{{
+// Serializes the database once and atomically replaces the file with it
+inline void Db::commit()
+{
+  ethrow_if(m_mode == Mode::READ or not std::holds_alternative<json_t>(m_json)
+    , "Tried to commit read-only db '{}'"_fmt(m_path_file_db)
+  );
+  m_is_transaction = false;
+  m_is_committed = true;
+  std::string data = std::get<json_t>(m_json).dump(2);
+  // Concurrent commits write to distinct temporary files, the last rename wins
+  auto expected_write = ns_linux::write_atomic(m_path_file_db, data);
+  ethrow_if(not expected_write, expected_write.error());
+} // commit() }}}
+
 // data() {{{
 inline json_t& Db::data()
 {
@@ -276,7 +321,7 @@ std::set<T> Db::as_set() const
   json_t& json = data();
   ethrow_if(not json.is_array(), "Tried to access non-array as array in DB");
   std::set<T> set;
-  std::for_each(json.begin(), json.end(), [&](std::string e){ set.insert(T{e}); });
+  for (auto const& e : json) { set.emplace(e.template get_ref<std::string const&>()); }
   return set;
 } // as_set() }}}
 
@@ -287,7 +332,8 @@ std::vector<T> Db::as_vector() const
   json_t& json = data();
   ethrow_if(not json.is_array(), "Tried to access non-array as array in DB");
   std::vector<T> vector;
-  std::for_each(json.begin(), json.end(), [&](std::string e){ vector.push_back(T{e}); });
+  vector.reserve(json.size());
+  for (auto const& e : json) { vector.emplace_back(e.template get_ref<std::string const&>()); }
   return vector;
 } // as_vector() }}}
 
@@ -384,33 +430,22 @@ inline Db::operator std::string() const
 } // operator::string() }}}
 
 // operator[] {{{
-// Key exists and is accessed
+// Key exists and is accessed, the result refers to the json of this object
 template<ns_concept::StringRepresentable T>
-Db const& Db::operator[](T&& t) const
+Db Db::operator[](T&& t) const
 {
   std::string key = ns_string::to_string(t);
-  static std::unique_ptr<Db> db;
 
   json_t& json = data();
 
   // Check if key is present
-  if ( ! json.contains(key) )
+  auto it = json.find(key);
+  if ( it == json.end() )
   {
     "Key '{}' not present in db file"_throw(key);
   } // if
 
-  // Access key
-  try
-  {
-    db = std::unique_ptr<Db>(new Db{std::reference_wrapper<json_t>(json[key])});
-  } // try
-  catch(std::exception const& e)
-  {
-    "Failed to parse key '{}': {}"_throw(key, e.what());
-  } // catch
-
-  // Unreachable, used to suppress no return warning
-  return *db;
+  return Db{std::reference_wrapper<json_t>(*it)};
 } // operator[] }}}
 
 // operator() {{{
@@ -455,35 +490,26 @@ void from_file(T&& t, F&& f, Mode mode)
   f(db);
 } // function: from_file }}}
 
+// transaction() {{{
+// Opens the database, applies f and writes the result once, nothing is written if f throws
+template<ns_concept::StringRepresentable T, typename F>
+void transaction(T&& t, F&& f, Mode mode)
+{
+  Db db(std::forward<T>(t), mode);
+  db.begin();
+  f(db);
+  db.commit();
+} // function: transaction }}}
+
 // query() {{{
+// Reads the string at the path of keys args, the file is mapped and not parsed to a document
 template<typename F, typename... Args>
 inline std::string query(F&& file, Args... args)
 {
-  std::string ret;
-
-  auto f_access_impl = [&]<typename T, typename U>(T& ref_db, U&& u)
-  {
-    ref_db = std::reference_wrapper(ref_db.get()[u]);
-  }; // f_access
-
-  auto f_access = [&]<typename T, typename... U>(T& ref_db, U&&... u)
-  {
-    ( f_access_impl(ref_db, std::forward<U>(u)), ... );
-  }; // f_access
-
-  from_file(file, [&]<typename T>(T&& db)
-  {
-    // Get a ref to db
-    auto ref_db = std::reference_wrapper<Db const>(db);
-
-    // Update the ref to the selected query object
-    f_access(ref_db, std::forward<Args>(args)...);
-
-    // Assign result
-    ret = ref_db.get();
-  }, Mode::READ);
-
-  return ret;
+  DbFile db_file(fs::path{std::forward<F>(file)});
+  DbView view = db_file.view();
+  ( (view = view[ns_string::to_string(args)]), ... );
+  return view.as_string();
 } // query() }}}
 
 // query_nothrow() {{{
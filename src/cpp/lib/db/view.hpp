@@ -0,0 +1,383 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : view
+///
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../log.hpp"
+#include "../../macro.hpp"
+#include "../../common.hpp"
+
+// Read-only access to json text without building a document. Values are located on demand by
+// skipping over the text, a view is a string_view of one value and traversal does not allocate.
+// Only decoding strings with escape sequences allocates
+
+namespace ns_db
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// fn: skip_space() {{{
+inline size_t skip_space(std::string_view data, size_t pos)
+{
+  while ( pos < data.size() and (data[pos] == ' ' or data[pos] == '\n' or data[pos] == '\r' or data[pos] == '\t') )
+  {
+    ++pos;
+  } // while
+  return pos;
+} // fn: skip_space() }}}
+
+// fn: skip_string() {{{
+// pos is at the opening quote, returns the position after the closing quote
+inline size_t skip_string(std::string_view data, size_t pos)
+{
+  for (++pos; pos < data.size(); ++pos)
+  {
+    if ( data[pos] == '\\' ) { ++pos; }
+    else if ( data[pos] == '"' ) { return pos + 1; }
+  } // for
+  "Unterminated string in json"_throw();
+  return pos;
+} // fn: skip_string() }}}
+
+// fn: skip_value() {{{
+// pos is at the start of a value, returns the position after it
+inline size_t skip_value(std::string_view data, size_t pos)
+{
+  ethrow_if(pos >= data.size(), "Unexpected end of json");
+  switch ( data[pos] )
+  {
+    case '"': return skip_string(data, pos);
+    case '{':
+    case '[':
+    {
+      uint64_t depth = 0;
+      for (; pos < data.size(); ++pos)
+      {
+        switch ( data[pos] )
+        {
+          case '"': pos = skip_string(data, pos) - 1; break;
+          case '{': case '[': ++depth; break;
+          case '}': case ']': qreturn_if(--depth == 0, pos + 1); break;
+        } // switch
+      } // for
+      "Unterminated container in json"_throw();
+      return pos;
+    } // case
+    default:
+    {
+      // Number, boolean or null
+      size_t end = data.find_first_of(",}] \n\r\t", pos);
+      return (end == std::string_view::npos)? data.size() : end;
+    } // default
+  } // switch
+  return pos;
+} // fn: skip_value() }}}
+
+// fn: append_utf8() {{{
+inline void append_utf8(std::string& str, uint32_t code)
+{
+  if ( code < 0x80 ) { str.push_back(code); }
+  else if ( code < 0x800 ) { str.push_back(0xC0 | (code >> 6)); str.push_back(0x80 | (code & 0x3F)); }
+  else if ( code < 0x10000 )
+  {
+    str.push_back(0xE0 | (code >> 12));
+    str.push_back(0x80 | ((code >> 6) & 0x3F));
+    str.push_back(0x80 | (code & 0x3F));
+  } // else if
+  else
+  {
+    str.push_back(0xF0 | (code >> 18));
+    str.push_back(0x80 | ((code >> 12) & 0x3F));
+    str.push_back(0x80 | ((code >> 6) & 0x3F));
+    str.push_back(0x80 | (code & 0x3F));
+  } // else
+} // fn: append_utf8() }}}
+
+// fn: decode() {{{
+// Decodes the contents of a json string without the quotes
+inline std::string decode(std::string_view raw)
+{
+  std::string str;
+  str.reserve(raw.size());
+  auto f_hex = [&](size_t pos) -> uint32_t
+  {
+    ethrow_if(pos + 4 > raw.size(), "Truncated unicode escape in json");
+    return std::stoul(std::string{raw.substr(pos, 4)}, nullptr, 16);
+  };
+  for (size_t pos = 0; pos < raw.size(); ++pos)
+  {
+    if ( raw[pos] != '\\' ) { str.push_back(raw[pos]); continue; }
+    ethrow_if(++pos >= raw.size(), "Truncated escape in json");
+    switch ( raw[pos] )
+    {
+      case 'b': str.push_back('\b'); break;
+      case 'f': str.push_back('\f'); break;
+      case 'n': str.push_back('\n'); break;
+      case 'r': str.push_back('\r'); break;
+      case 't': str.push_back('\t'); break;
+      case 'u':
+      {
+        uint32_t code = f_hex(pos + 1);
+        pos += 4;
+        // Surrogate pair
+        if ( code >= 0xD800 and code < 0xDC00 and pos + 6 < raw.size() and raw[pos+1] == '\\' and raw[pos+2] == 'u' )
+        {
+          code = 0x10000 + ((code - 0xD800) << 10) + (f_hex(pos + 3) - 0xDC00);
+          pos += 6;
+        } // if
+        append_utf8(str, code);
+      } // case
+      break;
+      default: str.push_back(raw[pos]);
+    } // switch
+  } // for
+  return str;
+} // fn: decode() }}}
+
+} // namespace
+
+// class DbView {{{
+class DbView
+{
+  private:
+    std::string_view m_data;
+
+    // Wraps text already delimited to one value
+    struct Delimited {};
+    DbView(std::string_view data, Delimited) : m_data(data) {}
+
+    // Calls f(key, value) for each member until it returns false, key is the raw json string
+    template<typename F>
+    void members(F&& f) const;
+    // Calls f(value) for each element until it returns false
+    template<typename F>
+    void elements(F&& f) const;
+
+  public:
+    explicit DbView(std::string_view data);
+
+    [[nodiscard]] bool is_object() const { return m_data.front() == '{'; }
+    [[nodiscard]] bool is_array() const { return m_data.front() == '['; }
+    [[nodiscard]] bool is_string() const { return m_data.front() == '"'; }
+    [[nodiscard]] bool is_bool() const { return m_data == "true" or m_data == "false"; }
+    [[nodiscard]] bool is_null() const { return m_data == "null"; }
+    [[nodiscard]] std::string_view raw() const { return m_data; }
+
+    [[nodiscard]] std::optional<DbView> find(std::string_view key) const;
+    [[nodiscard]] bool contains(std::string_view key) const { return find(key).has_value(); }
+    [[nodiscard]] DbView operator[](std::string_view key) const;
+    [[nodiscard]] size_t size() const;
+
+    [[nodiscard]] std::string_view as_string_view() const;
+    [[nodiscard]] std::string as_string() const;
+    [[nodiscard]] bool as_bool() const;
+    template<typename T = std::string>
+    [[nodiscard]] std::vector<T> as_vector() const;
+    [[nodiscard]] std::vector<std::string> keys() const;
+
+    template<typename F>
+    void for_each(F&& f) const;
+    template<typename F>
+    void for_each_item(F&& f) const;
+}; // class DbView }}}
+
+// fn: DbView::DbView {{{
+inline DbView::DbView(std::string_view data)
+{
+  size_t begin = skip_space(data, 0);
+  ethrow_if(begin >= data.size(), "Empty json value");
+  m_data = data.substr(begin, skip_value(data, begin) - begin);
+} // fn: DbView::DbView }}}
+
+// fn: DbView::members {{{
+template<typename F>
+void DbView::members(F&& f) const
+{
+  ethrow_if(not is_object(), "Tried to access non-object as object in DB");
+  size_t pos = skip_space(m_data, 1);
+  while ( pos < m_data.size() and m_data[pos] != '}' )
+  {
+    ethrow_if(m_data[pos] != '"', "Expected key in json object");
+    size_t end_key = skip_string(m_data, pos);
+    std::string_view key = m_data.substr(pos, end_key - pos);
+    pos = skip_space(m_data, end_key);
+    ethrow_if(pos >= m_data.size() or m_data[pos] != ':', "Expected ':' in json object");
+    pos = skip_space(m_data, pos + 1);
+    size_t end_value = skip_value(m_data, pos);
+    qreturn_if(not f(DbView(key, Delimited{}), DbView(m_data.substr(pos, end_value - pos), Delimited{})));
+    pos = skip_space(m_data, end_value);
+    if ( pos < m_data.size() and m_data[pos] == ',' ) { pos = skip_space(m_data, pos + 1); }
+  } // while
+} // fn: DbView::members }}}
+
+// fn: DbView::elements {{{
+template<typename F>
+void DbView::elements(F&& f) const
+{
+  ethrow_if(not is_array(), "Tried to access non-array as array in DB");
+  size_t pos = skip_space(m_data, 1);
+  while ( pos < m_data.size() and m_data[pos] != ']' )
+  {
+    size_t end_value = skip_value(m_data, pos);
+    qreturn_if(not f(DbView(m_data.substr(pos, end_value - pos), Delimited{})));
+    pos = skip_space(m_data, end_value);
+    if ( pos < m_data.size() and m_data[pos] == ',' ) { pos = skip_space(m_data, pos + 1); }
+  } // while
+} // fn: DbView::elements }}}
+
+// fn: DbView::find {{{
+inline std::optional<DbView> DbView::find(std::string_view key) const
+{
+  std::optional<DbView> opt_value;
+  members([&](DbView const& view_key, DbView const& view_value)
+  {
+    std::string_view raw = view_key.m_data.substr(1, view_key.m_data.size() - 2);
+    // Keys with escapes are decoded to compare
+    bool is_match = (raw.find('\\') == std::string_view::npos)? raw == key : decode(raw) == key;
+    if ( is_match ) { opt_value = view_value; }
+    return not is_match;
+  });
+  return opt_value;
+} // fn: DbView::find }}}
+
+// fn: DbView::operator[] {{{
+inline DbView DbView::operator[](std::string_view key) const
+{
+  auto opt_value = find(key);
+  if ( not opt_value ) { "Key '{}' not present in db file"_throw(key); }
+  return *opt_value;
+} // fn: DbView::operator[] }}}
+
+// fn: DbView::size {{{
+inline size_t DbView::size() const
+{
+  size_t size = 0;
+  if ( is_object() ) { members([&](auto&&, auto&&){ ++size; return true; }); }
+  else { elements([&](auto&&){ ++size; return true; }); }
+  return size;
+} // fn: DbView::size }}}
+
+// fn: DbView::as_string_view {{{
+// Contents of a string without escape sequences, throws if it has any
+inline std::string_view DbView::as_string_view() const
+{
+  ethrow_if(not is_string(), "Tried to access non-string in DB");
+  std::string_view raw = m_data.substr(1, m_data.size() - 2);
+  ethrow_if(raw.find('\\') != std::string_view::npos, "String has escape sequences");
+  return raw;
+} // fn: DbView::as_string_view }}}
+
+// fn: DbView::as_string {{{
+inline std::string DbView::as_string() const
+{
+  ethrow_if(not is_string(), "Tried to access non-string in DB");
+  return decode(m_data.substr(1, m_data.size() - 2));
+} // fn: DbView::as_string }}}
+
+// fn: DbView::as_bool {{{
+inline bool DbView::as_bool() const
+{
+  ethrow_if(not is_bool(), "Tried to access non-boolean as boolean in DB");
+  return m_data == "true";
+} // fn: DbView::as_bool }}}
+
+// fn: DbView::as_vector {{{
+template<typename T>
+std::vector<T> DbView::as_vector() const
+{
+  std::vector<T> vector;
+  elements([&](DbView const& view){ vector.emplace_back(view.as_string()); return true; });
+  return vector;
+} // fn: DbView::as_vector }}}
+
+// fn: DbView::keys {{{
+inline std::vector<std::string> DbView::keys() const
+{
+  std::vector<std::string> keys;
+  members([&](DbView const& view_key, auto&&){ keys.push_back(view_key.as_string()); return true; });
+  return keys;
+} // fn: DbView::keys }}}
+
+// fn: DbView::for_each {{{
+// Calls f(DbView) for each element of an array
+template<typename F>
+void DbView::for_each(F&& f) const
+{
+  elements([&](DbView const& view){ f(view); return true; });
+} // fn: DbView::for_each }}}
+
+// fn: DbView::for_each_item {{{
+// Calls f(DbView key, DbView value) for each member of an object, the key is a json string
+template<typename F>
+void DbView::for_each_item(F&& f) const
+{
+  members([&](DbView const& view_key, DbView const& view_value){ f(view_key, view_value); return true; });
+} // fn: DbView::for_each_item }}}
+
+// class DbFile {{{
+// Maps a json file to memory for DbView
+class DbFile
+{
+  private:
+    void* m_data;
+    size_t m_size;
+
+  public:
+    explicit DbFile(fs::path const& path_file_db);
+    ~DbFile();
+    DbFile(DbFile const&) = delete;
+    DbFile(DbFile&&) = delete;
+    DbFile& operator=(DbFile const&) = delete;
+    DbFile& operator=(DbFile&&) = delete;
+    [[nodiscard]] DbView view() const;
+}; // class DbFile }}}
+
+// fn: DbFile::DbFile {{{
+inline DbFile::DbFile(fs::path const& path_file_db)
+  : m_data(MAP_FAILED)
+  , m_size(0)
+{
+  int fd = open(path_file_db.c_str(), O_RDONLY | O_CLOEXEC);
+  dthrow_if(fd < 0, "Could not open file '{}': {}"_fmt(path_file_db, strerror(errno)));
+  struct stat st;
+  if ( fstat(fd, &st) < 0 or st.st_size == 0 )
+  {
+    close(fd);
+    "Could not read file '{}'"_throw(path_file_db);
+  } // if
+  m_size = st.st_size;
+  m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  ethrow_if(m_data == MAP_FAILED, "Could not map file '{}': {}"_fmt(path_file_db, strerror(errno)));
+} // fn: DbFile::DbFile }}}
+
+// fn: DbFile::~DbFile {{{
+inline DbFile::~DbFile()
+{
+  if ( m_data != MAP_FAILED ) { munmap(m_data, m_size); }
+} // fn: DbFile::~DbFile }}}
+
+// fn: DbFile::view {{{
+inline DbView DbFile::view() const
+{
+  return DbView(std::string_view(static_cast<char const*>(m_data), m_size));
+} // fn: DbFile::view }}}
+
+} // namespace ns_db
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -21,6 +21,9 @@ namespace fs = std::filesystem;
 
 };
 
+// Default block size of mkdwarfs, the least cache of a layer that holds a decompressed block
+constexpr uint64_t const SIZE_BLOCK = 16777216;
+
 // class Dwarfs {{{
 class Dwarfs
 {
@@ -34,7 +37,13 @@ class Dwarfs
     Dwarfs& operator=(Dwarfs const&) = delete;
     Dwarfs& operator=(Dwarfs&&) = delete;
 
-    Dwarfs(fs::path const& path_file_image, fs::path const& path_dir_mount, uint64_t offset, uint64_t size_image, pid_t pid_to_die_for)
+    Dwarfs(fs::path const& path_file_image
+      , fs::path const& path_dir_mount
+      , uint64_t offset
+      , uint64_t size_image
+      , uint64_t size_cache
+      , uint32_t workers
+      , pid_t pid_to_die_for)
       : m_path_dir_mountpoint(path_dir_mount)
     {
       // Check if image exists and is a regular file
@@ -56,11 +65,10 @@ class Dwarfs
 
       // Spawn command
       (void) m_subprocess->with_piped_outputs()
-        .with_args(path_file_image, path_dir_mount, "-f", "-o", "auto_unmount,offset={},imagesize={}"_fmt(offset, size_image))
+        .with_args(path_file_image, path_dir_mount, "-f", "-o", "auto_unmount,offset={},imagesize={},cachesize={},workers={}"_fmt(offset, size_image, size_cache, workers))
         .with_die_on_pid(pid_to_die_for)
         .spawn();
-      // Wait for mount
-      ns_fuse::wait_fuse(path_dir_mount);
+      // The mount is ready after ns_fuse::wait_fuse, so several layers can start at once
     } // Dwarfs
     
     ~Dwarfs()
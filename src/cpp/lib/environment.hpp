@@ -0,0 +1,190 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : environment
+///
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+namespace ns_environment
+{
+
+namespace
+{
+
+// Size of each block of the string arena
+constexpr size_t const SIZE_CHUNK = 16384;
+
+} // namespace
+
+// class Environment {{{
+// Set of 'KEY=VALUE' variables. Entries are stored null-terminated in an append-only arena and
+// indexed by key, so lookups are O(1) and 'envp()' is available without copies
+class Environment
+{
+  private:
+    // Arena, pointers to its strings stay valid until the object is destroyed
+    std::vector<std::unique_ptr<char[]>> m_chunks;
+    size_t m_offset_chunk;
+    // Null-terminated array of 'KEY=VALUE' entries
+    std::vector<char*> m_envp;
+    // Key to position in m_envp
+    std::unordered_map<std::string_view,size_t> m_index;
+
+    char* store(std::string_view key, std::string_view value);
+
+  public:
+    Environment();
+    explicit Environment(char** envp);
+    Environment(Environment const&) = delete;
+    Environment& operator=(Environment const&) = delete;
+    Environment(Environment&&) = default;
+    Environment& operator=(Environment&&) = default;
+
+    void set(std::string_view key, std::string_view value);
+    bool set(std::string_view entry);
+    bool erase(std::string_view key);
+    void clear();
+
+    [[nodiscard]] bool contains(std::string_view key) const;
+    [[nodiscard]] std::optional<std::string_view> get(std::string_view key) const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] char* const* envp() const;
+
+    [[nodiscard]] auto cbegin() const { return m_envp.cbegin(); }
+    [[nodiscard]] auto cend() const { return std::prev(m_envp.cend()); }
+    [[nodiscard]] auto begin() const { return cbegin(); }
+    [[nodiscard]] auto end() const { return cend(); }
+}; // class Environment }}}
+
+// fn: Environment::Environment {{{
+inline Environment::Environment()
+  : m_offset_chunk(SIZE_CHUNK)
+  , m_envp{nullptr}
+{
+} // fn: Environment::Environment }}}
+
+// fn: Environment::Environment {{{
+inline Environment::Environment(char** envp)
+  : Environment()
+{
+  for(char** i = envp; i != nullptr and *i != nullptr; ++i)
+  {
+    set(*i);
+  } // for
+} // fn: Environment::Environment }}}
+
+// fn: Environment::store {{{
+// Copies 'key=value' into the arena
+inline char* Environment::store(std::string_view key, std::string_view value)
+{
+  size_t size = key.size() + value.size() + 2;
+  // Allocate a novel chunk, large entries get their own
+  if ( m_chunks.empty() or m_offset_chunk + size > SIZE_CHUNK )
+  {
+    m_chunks.push_back(std::make_unique_for_overwrite<char[]>(std::max(size, SIZE_CHUNK)));
+    m_offset_chunk = 0;
+  } // if
+  char* entry = m_chunks.back().get() + m_offset_chunk;
+  std::memcpy(entry, key.data(), key.size());
+  entry[key.size()] = '=';
+  std::memcpy(entry + key.size() + 1, value.data(), value.size());
+  entry[size-1] = '\0';
+  // A large entry fills its chunk
+  m_offset_chunk = (size > SIZE_CHUNK)? SIZE_CHUNK : m_offset_chunk + size;
+  return entry;
+} // fn: Environment::store }}}
+
+// fn: Environment::set {{{
+inline void Environment::set(std::string_view key, std::string_view value)
+{
+  char* entry = store(key, value);
+  std::string_view key_stored(entry, key.size());
+  if ( auto it = m_index.find(key); it != m_index.end() )
+  {
+    m_envp[it->second] = entry;
+    return;
+  } // if
+  // Insert before the terminating nullptr
+  m_envp.back() = entry;
+  m_envp.push_back(nullptr);
+  m_index.emplace(key_stored, m_envp.size() - 2);
+} // fn: Environment::set }}}
+
+// fn: Environment::set {{{
+// Sets from a 'KEY=VALUE' entry, returns false if it is not valid
+inline bool Environment::set(std::string_view entry)
+{
+  size_t pos = entry.find('=');
+  if ( pos == std::string_view::npos or pos == 0 ) { return false; }
+  set(entry.substr(0, pos), entry.substr(pos+1));
+  return true;
+} // fn: Environment::set }}}
+
+// fn: Environment::erase {{{
+// Returns true if the key existed
+inline bool Environment::erase(std::string_view key)
+{
+  auto it = m_index.find(key);
+  if ( it == m_index.end() ) { return false; }
+  // Move the last entry into the erased position
+  size_t index = it->second;
+  size_t index_last = m_envp.size() - 2;
+  m_index.erase(it);
+  if ( index != index_last )
+  {
+    char* entry_last = m_envp[index_last];
+    m_envp[index] = entry_last;
+    m_index[std::string_view(entry_last, std::strchr(entry_last, '=') - entry_last)] = index;
+  } // if
+  m_envp.pop_back();
+  m_envp.back() = nullptr;
+  return true;
+} // fn: Environment::erase }}}
+
+// fn: Environment::clear {{{
+inline void Environment::clear()
+{
+  m_chunks.clear();
+  m_offset_chunk = SIZE_CHUNK;
+  m_envp = {nullptr};
+  m_index.clear();
+} // fn: Environment::clear }}}
+
+// fn: Environment::contains {{{
+inline bool Environment::contains(std::string_view key) const
+{
+  return m_index.contains(key);
+} // fn: Environment::contains }}}
+
+// fn: Environment::get {{{
+inline std::optional<std::string_view> Environment::get(std::string_view key) const
+{
+  auto it = m_index.find(key);
+  if ( it == m_index.end() ) { return std::nullopt; }
+  return std::string_view(m_envp[it->second] + key.size() + 1);
+} // fn: Environment::get }}}
+
+// fn: Environment::size {{{
+inline size_t Environment::size() const
+{
+  return m_envp.size() - 1;
+} // fn: Environment::size }}}
+
+// fn: Environment::envp {{{
+// Null-terminated, valid until the next modification
+inline char* const* Environment::envp() const
+{
+  return m_envp.data();
+} // fn: Environment::envp }}}
+
+} // namespace ns_environment
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,105 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : erofs
+///
+
+#pragma once
+
+#include <filesystem>
+#include "log.hpp"
+#include "fuse.hpp"
+#include "subprocess.hpp"
+#include "../macro.hpp"
+
+namespace ns_erofs
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+};
+
+// class Erofs {{{
+class Erofs
+{
+  private:
+    std::unique_ptr<ns_subprocess::Subprocess> m_subprocess;
+    fs::path m_path_dir_mountpoint;
+
+  public:
+    Erofs(Erofs const&) = delete;
+    Erofs(Erofs&&) = delete;
+    Erofs& operator=(Erofs const&) = delete;
+    Erofs& operator=(Erofs&&) = delete;
+
+    Erofs(fs::path const& path_file_image, fs::path const& path_dir_mount, uint64_t offset, pid_t pid_to_die_for)
+      : m_path_dir_mountpoint(path_dir_mount)
+    {
+      // Check if image exists and is a regular file
+      ethrow_if(not fs::is_regular_file(path_file_image)
+        , "'{}' does not exist or is not a regular file"_fmt(path_file_image)
+      );
+
+      // Check if mountpoint exists and is directory
+      ethrow_if(not fs::is_directory(path_dir_mount)
+        , "'{}' does not exist or is not a directory"_fmt(path_dir_mount)
+      );
+
+      // Find command in PATH
+      auto opt_path_file_erofs = ns_subprocess::search_path("erofsfuse");
+      ethrow_if(not opt_path_file_erofs.has_value(), "Could not find erofsfuse");
+
+      // Create command
+      m_subprocess = std::make_unique<ns_subprocess::Subprocess>(*opt_path_file_erofs);
+
+      // Spawn command
+       (void) m_subprocess->with_piped_outputs()
+        .with_args("-f", "--offset={}"_fmt(offset))
+        .with_args(path_file_image, path_dir_mount)
+        .with_die_on_pid(pid_to_die_for)
+        .spawn();
+      // The mount is ready after ns_fuse::wait_fuse, so several layers can start at once
+    } // Erofs
+    
+    ~Erofs()
+    {
+      // Un-mount
+      ns_fuse::unmount(m_path_dir_mountpoint);
+      // Tell process to exit with SIGTERM
+      if ( auto opt_pid = m_subprocess->get_pid() )
+      {
+        kill(*opt_pid, SIGTERM);
+      } // if
+      // Wait for process to exit
+      auto ret = m_subprocess->wait();
+      dreturn_if(not ret, "Mount '{}' exited unexpectedly"_fmt(m_path_dir_mountpoint));
+      dreturn_if(ret and *ret != 0, "Mount '{}' exited with non-zero exit code '{}'"_fmt(m_path_dir_mountpoint, *ret));
+    } // Erofs
+
+    fs::path const& get_dir_mountpoint()
+    {
+      return m_path_dir_mountpoint;
+    }
+}; // class Erofs }}}
+
+// is_erofs() {{{
+inline bool is_erofs(fs::path const& path_file_erofs, uint64_t offset = 0)
+{
+  // Open file
+  std::ifstream file_erofs(path_file_erofs, std::ios::binary | std::ios::in);
+  ereturn_if(not file_erofs.is_open(), "Could not open file '{}'"_fmt(path_file_erofs), false);
+  // The superblock starts 1024 bytes into the filesystem
+  file_erofs.seekg(offset + 1024);
+  ereturn_if(not file_erofs, "Failed to seek offset '{}' in file '{}'"_fmt(offset, path_file_erofs), false);
+  // Read little-endian magic number
+  std::array<unsigned char,4> header;
+  qreturn_if(not file_erofs.read(reinterpret_cast<char*>(header.data()), header.size()), false);
+  // Check for match
+  return std::ranges::equal(header, std::array<unsigned char,4>{0xE2, 0xE1, 0xF5, 0xE0});
+} // is_erofs() }}}
+
+} // namespace ns_erofs
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
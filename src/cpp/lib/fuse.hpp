@@ -11,6 +11,7 @@
 #include <sys/vfs.h>
 #include <sys/mount.h>
 #include <thread>
+#include <memory>
 
 #include "subprocess.hpp"
 
@@ -41,53 +42,67 @@ inline std::expected<bool,std::string> is_fuse(fs::path const& path_dir_mount)
   return buf.f_type == FUSE_SUPER_MAGIC;
 } // function: mountpoint
 
-inline void wait_fuse(fs::path const& path_dir_filesystem)
+// Waits until all the directories are fuse mountpoints
+inline void wait_fuse(std::vector<fs::path> vec_path_dir_filesystems)
 {
-  using namespace std::chrono_literals;
   auto time_beg = std::chrono::system_clock::now();
-  while ( true )
+  while ( not vec_path_dir_filesystems.empty() )
   {
-    auto expected_is_fuse = ns_fuse::is_fuse(path_dir_filesystem);
-    ebreak_if(not expected_is_fuse, "Could not check if filesystem is fuse");
-    dbreak_if( *expected_is_fuse, "Filesystem '{}' is fuse"_fmt(path_dir_filesystem));
+    // Remove filesystems that are ready
+    std::erase_if(vec_path_dir_filesystems, [](auto&& path_dir_filesystem)
+    {
+      auto expected_is_fuse = ns_fuse::is_fuse(path_dir_filesystem);
+      ereturn_if(not expected_is_fuse, "Could not check if filesystem is fuse", true);
+      dreturn_if(*expected_is_fuse, "Filesystem '{}' is fuse"_fmt(path_dir_filesystem), true);
+      return false;
+    });
     auto time_cur = std::chrono::system_clock::now();
     auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(time_cur - time_beg);
     ebreak_if(elapsed.count() > 60, "Reached timeout to wait for fuse filesystems");
   } // while
 } // function: wait_fuse
 
+inline void wait_fuse(fs::path const& path_dir_filesystem)
+{
+  wait_fuse(std::vector<fs::path>{path_dir_filesystem});
+} // function: wait_fuse
 
-inline void unmount(fs::path const& path_dir_mountpoint)
+
+// Lazily un-mounts the filesystems, fusermount processes run in parallel
+inline void unmount(std::vector<fs::path> const& vec_path_dir_mountpoints)
 {
-  using namespace std::chrono_literals;
+  qreturn_if(vec_path_dir_mountpoints.empty());
 
   // Find fusermount
   auto opt_path_file_fusermount = ns_subprocess::search_path("fusermount");
   ereturn_if (not opt_path_file_fusermount, "Could not find 'fusermount' in PATH");
 
-  // Un-mount filesystem
-  auto ret = ns_subprocess::Subprocess(*opt_path_file_fusermount)
-    .with_piped_outputs()
-    .with_args("-zu", path_dir_mountpoint)
-    .spawn()
-    .wait();
-
-  // Check for successful un-mount
-  if(ret and *ret == 0)
+  // Un-mount filesystems
+  std::vector<std::unique_ptr<ns_subprocess::Subprocess>> vec_subprocesses;
+  for (auto&& path_dir_mountpoint : vec_path_dir_mountpoints)
   {
-    ns_log::debug()("Un-mounted filesystem '{}'"_fmt(path_dir_mountpoint));
-  } // if
-
-  // Filesystem could be busy for a bit after un-mount
-  std::expected<bool,std::string> expected_is_fuse = ns_fuse::is_fuse(*opt_path_file_fusermount);
-  while( expected_is_fuse and *expected_is_fuse )
+    auto& subprocess = vec_subprocesses.emplace_back(std::make_unique<ns_subprocess::Subprocess>(*opt_path_file_fusermount));
+    (void) subprocess->with_piped_outputs()
+      .with_args("-zu", path_dir_mountpoint)
+      .spawn();
+  } // for
+
+  // Wait for all processes
+  for (size_t i = 0; i < vec_subprocesses.size(); ++i)
   {
-    std::this_thread::sleep_for(100ms);
-    expected_is_fuse = ns_fuse::is_fuse(*opt_path_file_fusermount);
-  } // while
+    fs::path const& path_dir_mountpoint = vec_path_dir_mountpoints.at(i);
+    auto ret = vec_subprocesses.at(i)->wait();
+    // Check for successful un-mount
+    dcontinue_if(ret and *ret == 0, "Un-mounted filesystem '{}'"_fmt(path_dir_mountpoint));
+    // A lazy un-mount detaches the filesystem right away, check if it is still there
+    auto expected_is_fuse = ns_fuse::is_fuse(path_dir_mountpoint);
+    elog_if(expected_is_fuse and *expected_is_fuse, "Failed to un-mount '{}'"_fmt(path_dir_mountpoint));
+  } // for
+} // function: unmount
 
-  // Check for query errors
-  ereturn_if(not expected_is_fuse, expected_is_fuse.error());
+inline void unmount(fs::path const& path_dir_mountpoint)
+{
+  unmount(std::vector<fs::path>{path_dir_mountpoint});
 } // function: unmount
 
 } // namespace ns_fuse
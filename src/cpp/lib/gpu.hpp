@@ -0,0 +1,260 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : gpu
+///
+
+#pragma once
+
+#include <array>
+#include <future>
+#include <string>
+#include <deque>
+#include <ranges>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <sys/stat.h>
+
+#include "../macro.hpp"
+#include "../std/filesystem.hpp"
+#include "log.hpp"
+#include "linux.hpp"
+
+namespace ns_gpu
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// struct Search {{{
+// Host directory with driver files, entries match if their name contains one of the keywords
+struct Search
+{
+  std::string_view path_dir;
+  std::vector<std::string_view> keywords;
+}; // struct Search }}}
+
+// Directories scanned for the nvidia driver
+inline std::array<Search,7> const SEARCH
+{{
+    {"/usr/lib", {"nvidia", "cuda", "nvcuvid", "nvoptix"}}
+  , {"/usr/lib/x86_64-linux-gnu", {"nvidia", "cuda", "nvcuvid", "nvoptix"}}
+  , {"/usr/lib/i386-linux-gnu", {"nvidia", "cuda", "nvcuvid", "nvoptix"}}
+  , {"/usr/bin", {"nvidia"}}
+  , {"/usr/share", {"nvidia"}}
+  , {"/usr/share/vulkan/icd.d", {"nvidia"}}
+  , {"/usr/lib32", {"nvidia", "cuda"}}
+}};
+
+// Paths that contain these are not shared with the container
+inline std::array<std::string_view,3> const EXCLUDE{"gst", "icudata", "egl-wayland"};
+
+// fn: scan() {{{
+// Finds the driver files in a directory, pairs of the file and the end of its symlink chain
+inline std::vector<std::pair<fs::path,fs::path>> scan(Search const& search)
+{
+  std::vector<std::pair<fs::path,fs::path>> vec_links;
+  std::error_code ec;
+  ireturn_if(not fs::exists(search.path_dir, ec), "Search path does not exist: '{}'"_fmt(search.path_dir), vec_links);
+  for(auto&& entry : fs::directory_iterator(search.path_dir, ec))
+  {
+    fs::path const& path_file_entry = entry.path();
+    std::string str_file_entry = path_file_entry.string();
+    // Skip ignored matches
+    dcontinue_if(std::ranges::any_of(EXCLUDE, [&](auto&& e){ return str_file_entry.contains(e); })
+      , "Ignoring match '{}'"_fmt(path_file_entry)
+    );
+    // Skip files that do not match keywords
+    std::string str_name = path_file_entry.filename().string();
+    qcontinue_if(not std::ranges::any_of(search.keywords, [&](auto&& e){ return str_name.contains(e); }));
+    // Skip directories
+    qcontinue_if(entry.is_directory(ec));
+    // Symlink target is the file and the end of the symlink chain
+    auto path_file_entry_realpath = ns_filesystem::ns_path::realpath(path_file_entry);
+    econtinue_if(not path_file_entry_realpath, "Broken symlink: '{}'"_fmt(path_file_entry));
+    vec_links.emplace_back(path_file_entry, *path_file_entry_realpath);
+  } // for
+  return vec_links;
+} // fn: scan() }}}
+
+// fn: key() {{{
+// Changes with the driver version or when files are added to or removed from the searched dirs
+inline std::string key()
+{
+  std::string key;
+  if ( std::ifstream file{"/proc/driver/nvidia/version"}; file.is_open() )
+  {
+    std::getline(file, key);
+  } // if
+  for (auto&& search : SEARCH)
+  {
+    struct stat st;
+    qcontinue_if(::stat(std::string{search.path_dir}.c_str(), &st) < 0);
+    key += ":{}.{}"_fmt(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+  } // for
+  return key;
+} // fn: key() }}}
+
+// fn: find() {{{
+// Entry of path in the merged view of the layers, the last layer is the top one. Symlinks are not
+// followed, a layer where a parent of path is not a directory hides path in the layers below it
+inline std::optional<fs::path> find(std::vector<fs::path> const& vec_path_dir_layers, fs::path const& path)
+{
+  fs::path path_relative = path.relative_path();
+  for (auto&& path_dir_layer : vec_path_dir_layers | std::views::reverse)
+  {
+    fs::path path_entry = path_dir_layer;
+    for (auto it = path_relative.begin(); it != path_relative.end(); ++it)
+    {
+      std::error_code ec;
+      path_entry /= *it;
+      auto status = fs::symlink_status(path_entry, ec);
+      qbreak_if(not fs::exists(status));
+      qreturn_if(std::next(it) == path_relative.end(), path_entry);
+      qreturn_if(not fs::is_directory(status), std::nullopt);
+    } // for
+  } // for
+  return std::nullopt;
+} // fn: find() }}}
+
+// fn: resolve() {{{
+// Resolves the symlinks in the parent directories of path_file against the layers, so links are
+// created where the container sees them. Returns nullopt on a symlink loop
+inline std::optional<fs::path> resolve(std::vector<fs::path> const& vec_path_dir_layers, fs::path const& path_file)
+{
+  fs::path path_resolved = "/";
+  fs::path path_parent = path_file.parent_path().relative_path();
+  std::deque<fs::path> deque_components(path_parent.begin(), path_parent.end());
+  for (int hops = 0; not deque_components.empty();)
+  {
+    fs::path component = deque_components.front();
+    deque_components.pop_front();
+    qcontinue_if(component == "." or component.empty());
+    if ( component == ".." ) { path_resolved = path_resolved.parent_path(); continue; }
+    fs::path path_next = path_resolved / component;
+    // Directories and entries missing from the layers are kept
+    auto opt_path_entry = find(vec_path_dir_layers, path_next);
+    std::error_code ec;
+    if ( not opt_path_entry or not fs::is_symlink(fs::symlink_status(*opt_path_entry, ec)) )
+    {
+      path_resolved = path_next;
+      continue;
+    } // if
+    // Follow the symlink inside the layers, never on the host
+    qreturn_if(++hops > 40, std::nullopt);
+    fs::path path_target = fs::read_symlink(*opt_path_entry, ec);
+    qreturn_if(ec, std::nullopt);
+    if ( path_target.is_absolute() ) { path_resolved = "/"; }
+    fs::path path_target_relative = path_target.relative_path();
+    deque_components.insert(deque_components.begin(), path_target_relative.begin(), path_target_relative.end());
+  } // for
+  return path_resolved / path_file.filename();
+} // fn: resolve() }}}
+
+} // namespace
+
+// struct Link {{{
+// Driver file on the host and the end of its symlink chain
+struct Link
+{
+  fs::path path_file;
+  fs::path path_file_target;
+}; // struct Link }}}
+
+// fn: manifest() {{{
+// Driver files of the host, read from path_file_cache if the driver and the searched directories
+// did not change, otherwise scanned in parallel and saved to path_file_cache
+inline std::vector<Link> manifest(fs::path const& path_file_cache)
+{
+  std::string str_key = key();
+  std::vector<Link> vec_links;
+  // One line with the key, one with the count of entries, followed by 'file\ttarget' lines
+  if ( std::ifstream file{path_file_cache}; file.is_open() )
+  {
+    std::string line;
+    std::string str_count;
+    if ( std::getline(file, line) and line == str_key and std::getline(file, str_count) )
+    {
+      while ( std::getline(file, line) )
+      {
+        size_t pos = line.find('\t');
+        qcontinue_if(pos == std::string::npos);
+        vec_links.push_back(Link{ .path_file = line.substr(0, pos), .path_file_target = line.substr(pos+1) });
+      } // while
+      // A truncated manifest is scanned again
+      if ( str_count == std::to_string(vec_links.size()) )
+      {
+        ns_log::debug()("Using cached gpu manifest with '{}' entries", vec_links.size());
+        return vec_links;
+      } // if
+      ns_log::debug()("Incomplete gpu manifest, scanning again");
+      vec_links.clear();
+    } // if
+  } // if
+  // Scan each directory in its own thread
+  std::vector<std::future<std::vector<std::pair<fs::path,fs::path>>>> vec_futures;
+  std::ranges::transform(SEARCH, std::back_inserter(vec_futures), [](auto&& e)
+  {
+    return std::async(std::launch::async, scan, std::cref(e));
+  });
+  for (auto&& future : vec_futures)
+  {
+    for (auto&& [path_file, path_file_target] : future.get())
+    {
+      vec_links.push_back(Link{ .path_file = path_file, .path_file_target = path_file_target });
+    } // for
+  } // for
+  // Save manifest, paths with line breaks or tabs are not representable and not cached
+  std::string data;
+  uint64_t count = 0;
+  for (auto&& link : vec_links)
+  {
+    qcontinue_if(link.path_file.string().find_first_of("\t\n") != std::string::npos
+      or link.path_file_target.string().find_first_of("\t\n") != std::string::npos
+    );
+    data += "{}\t{}\n"_fmt(link.path_file.string(), link.path_file_target.string());
+    count += 1;
+  } // for
+  auto expected_write = ns_linux::write_atomic(path_file_cache, "{}\n{}\n{}"_fmt(str_key, count, data));
+  elog_if(not expected_write, "Could not save gpu manifest: {}"_fmt(expected_write.error()));
+  return vec_links;
+} // fn: manifest() }}}
+
+// fn: populate() {{{
+// Creates a symlink in path_dir_layer for each driver file, pointing to its target under
+// path_dir_root_host. The parent directories are resolved against the layers in
+// vec_path_dir_shadow, so a directory of the host does not hide a symlink of the container, e.g.,
+// '/usr/lib32' to 'lib'. Files that exist as regular files or directories in the layers are
+// provided by the container and skipped
+inline void populate(std::vector<Link> const& vec_links
+  , fs::path const& path_dir_layer
+  , fs::path const& path_dir_root_host
+  , std::vector<fs::path> const& vec_path_dir_shadow)
+{
+  for (auto&& link : vec_links)
+  {
+    fs::path path_link_target = path_dir_root_host / link.path_file_target.relative_path();
+    auto opt_path_file = resolve(vec_path_dir_shadow, link.path_file);
+    econtinue_if(not opt_path_file, "Could not resolve '{}' in the layers"_fmt(link.path_file));
+    fs::path path_link_name = path_dir_layer / opt_path_file->relative_path();
+    // File already exists in the container as a regular file or directory, skip
+    std::error_code ec;
+    auto opt_path_entry = find(vec_path_dir_shadow, *opt_path_file);
+    qcontinue_if(opt_path_entry and not fs::is_symlink(fs::symlink_status(*opt_path_entry, ec)));
+    // Another driver file resolved to the same location, the first one is kept
+    dcontinue_if(fs::exists(fs::symlink_status(path_link_name, ec)), "Already linked: '{}'"_fmt(path_link_name));
+    // Create parent directories
+    fs::create_directories(path_link_name.parent_path(), ec);
+    econtinue_if (ec, ec.message());
+    // Symlink
+    econtinue_if(symlink(path_link_target.c_str(), path_link_name.c_str()) < 0, "{}: {}"_fmt(strerror(errno), path_link_name));
+    // Log symlink successful
+    ns_log::debug()("PERM(NVIDIA): {} -> {}", path_link_name, path_link_target);
+  } // for
+} // fn: populate() }}}
+
+} // namespace ns_gpu
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -0,0 +1,105 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : layer
+///
+
+#pragma once
+
+#include <memory>
+#include <variant>
+#include <optional>
+#include <filesystem>
+
+#include "dwarfs.hpp"
+#include "squashfs.hpp"
+#include "erofs.hpp"
+
+namespace ns_layer
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+} // namespace
+
+// EROFS is taken by errno.h, so the erofs format is EROFS_FS and this does not use the ENUM macro
+enum class Format
+{
+  DWARFS,
+  SQUASHFS,
+  EROFS_FS,
+};
+
+// to_string() {{{
+inline std::string to_string(Format format)
+{
+  switch(format)
+  {
+    case Format::DWARFS: return "dwarfs";
+    case Format::SQUASHFS: return "squashfs";
+    case Format::EROFS_FS: return "erofs";
+  } // switch
+  throw std::runtime_error("Unsupported layer format");
+} // to_string() }}}
+
+// from_string() {{{
+inline Format from_string(std::string_view str_format)
+{
+  for(Format format : {Format::DWARFS, Format::SQUASHFS, Format::EROFS_FS})
+  {
+    qreturn_if(to_string(format) == str_format, format);
+  } // for
+  throw std::runtime_error("Unsupported layer format '{}'"_fmt(str_format));
+} // from_string() }}}
+
+// A mounted layer, un-mounted when destroyed
+using Layer = std::variant<std::unique_ptr<ns_dwarfs::Dwarfs>
+  , std::unique_ptr<ns_squashfs::SquashFs>
+  , std::unique_ptr<ns_erofs::Erofs>
+>;
+
+// detect() {{{
+inline std::optional<Format> detect(fs::path const& path_file_image, uint64_t offset = 0)
+{
+  if ( ns_dwarfs::is_dwarfs(path_file_image, offset) ) { return Format::DWARFS; }
+  if ( ns_squashfs::is_squashfs(path_file_image, offset) ) { return Format::SQUASHFS; }
+  if ( ns_erofs::is_erofs(path_file_image, offset) ) { return Format::EROFS_FS; }
+  return std::nullopt;
+} // detect() }}}
+
+// mount() {{{
+// Starts the filesystem process, wait on path_dir_mount with ns_fuse::wait_fuse before using it.
+// size_cache and workers are only used by formats that have their own block cache
+inline Layer mount(Format format
+  , fs::path const& path_file_image
+  , fs::path const& path_dir_mount
+  , uint64_t offset
+  , uint64_t size_image
+  , uint64_t size_cache
+  , uint32_t workers
+  , pid_t pid_to_die_for)
+{
+  switch(format)
+  {
+    case Format::DWARFS:
+      return std::make_unique<ns_dwarfs::Dwarfs>(path_file_image
+        , path_dir_mount
+        , offset
+        , size_image
+        , size_cache
+        , workers
+        , pid_to_die_for
+      );
+    case Format::SQUASHFS:
+      return std::make_unique<ns_squashfs::SquashFs>(path_file_image, path_dir_mount, offset, pid_to_die_for);
+    case Format::EROFS_FS:
+      return std::make_unique<ns_erofs::Erofs>(path_file_image, path_dir_mount, offset, pid_to_die_for);
+  } // switch
+  throw std::runtime_error("Unsupported layer format");
+} // mount() }}}
+
+} // namespace ns_layer
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
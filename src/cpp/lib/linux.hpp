@@ -7,8 +7,13 @@
 
 #include <cstring>
 #include <string>
+#include <fstream>
+#include <expected>
+#include <algorithm>
 #include <filesystem>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "log.hpp"
 #include "../common.hpp"
@@ -51,6 +56,46 @@ namespace fs = std::filesystem;
 }
 // mkstemp() }}}
 
+// write_atomic() {{{
+// Replaces path_file with data through a unique temporary file in the same directory, so
+// concurrent writers do not mix their data and readers see the old or the new file. The mode of
+// the replaced file is kept, novel files are created with 'mode'
+[[nodiscard]] inline std::expected<void, std::string> write_atomic(fs::path const& path_file
+  , std::string_view data
+  , mode_t mode = 0644)
+{
+  fs::path path_dir_parent = path_file.parent_path().empty()? fs::path{"."} : path_file.parent_path();
+  std::string str_template = (path_dir_parent / "{}.XXXXXX"_fmt(path_file.filename().string())).string();
+  int fd = ::mkstemp(str_template.data());
+  qreturn_if(fd < 0, std::unexpected("Could not create temporary file for '{}': {}"_fmt(path_file, strerror(errno))));
+  // mkstemp creates the file with mode 0600
+  struct stat stat_file;
+  if ( stat(path_file.c_str(), &stat_file) == 0 ) { mode = stat_file.st_mode & 07777; }
+  bool is_written = fchmod(fd, mode) == 0;
+  for (size_t offset = 0; is_written and offset < data.size();)
+  {
+    ssize_t count = write(fd, data.data() + offset, data.size() - offset);
+    qcontinue_if(count < 0 and errno == EINTR);
+    is_written = count > 0;
+    offset += std::max<ssize_t>(count, 0);
+  } // for
+  is_written = is_written and fsync(fd) == 0;
+  std::string error = strerror(errno);
+  close(fd);
+  if ( not is_written or rename(str_template.c_str(), path_file.c_str()) < 0 )
+  {
+    error = (is_written)? strerror(errno) : error;
+    unlink(str_template.c_str());
+    return std::unexpected("Could not write '{}': {}"_fmt(path_file, error));
+  } // if
+  // Persist the rename
+  int fd_dir = open(path_dir_parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  qreturn_if(fd_dir < 0, {});
+  elog_if(fsync(fd_dir) < 0, "Could not sync directory '{}': {}"_fmt(path_dir_parent, strerror(errno)));
+  close(fd_dir);
+  return {};
+} // write_atomic() }}}
+
 // module_check() {{{
 inline std::expected<bool, std::string> module_check(std::string_view str_name)
 {
@@ -7,6 +7,8 @@
 
 #include <filesystem>
 #include <fstream>
+#include <mutex>
+#include <pthread.h>
 
 #include "../common.hpp"
 #include "../std/concept.hpp"
@@ -29,6 +31,9 @@ namespace
 
 namespace fs = std::filesystem;
 
+// Serializes log lines, the subprocess reactor logs from its own thread
+static std::mutex mutex_logger;
+
 // class Logger {{{
 class Logger
 {
@@ -51,6 +56,11 @@ class Logger
 inline Logger::Logger()
   : m_level(Level::QUIET)
 {
+  // Do not fork while another thread holds the lock, the child would never acquire it
+  pthread_atfork([]{ mutex_logger.lock(); }
+    , []{ mutex_logger.unlock(); }
+    , []{ mutex_logger.unlock(); }
+  );
 } // fn: Logger::Logger }}}
 
 // fn: Logger::set_sink_file {{{
@@ -142,6 +152,7 @@ class info
     requires ( ( ns_concept::StringRepresentable<Args> or ns_concept::IterableConst<Args> ) and ... )
     void operator()(T&& format, Args&&... args)
     {
+      std::lock_guard lock(mutex_logger);
       auto& opt_ostream_sink = logger.get_sink_file();
       print_if(opt_ostream_sink, *opt_ostream_sink, "I::{}::{}\n"_fmt(m_loc.get(), format), args...);
       print_if((logger.get_level() >= Level::INFO), std::cout, "I::{}::{}\n"_fmt(m_loc.get(), format), std::forward<Args>(args)...);
@@ -160,6 +171,7 @@ class error
     requires ( ( ns_concept::StringRepresentable<Args> or ns_concept::IterableConst<Args> ) and ... )
     void operator()(T&& format, Args&&... args)
     {
+      std::lock_guard lock(mutex_logger);
       auto& opt_ostream_sink = logger.get_sink_file();
       print_if(opt_ostream_sink, *opt_ostream_sink, "E::{}::{}\n"_fmt(m_loc.get(), format), args...);
       print_if((logger.get_level() >= Level::ERROR), std::cerr, "E::{}::{}\n"_fmt(m_loc.get(), format), std::forward<Args>(args)...);
@@ -178,6 +190,7 @@ class debug
     requires ( ( ns_concept::StringRepresentable<Args> or ns_concept::IterableConst<Args> ) and ... )
     void operator()(T&& format, Args&&... args)
     {
+      std::lock_guard lock(mutex_logger);
       auto& opt_ostream_sink = logger.get_sink_file();
       print_if(opt_ostream_sink, *opt_ostream_sink, "D::{}::{}\n"_fmt(m_loc.get(), format), args...);
       print_if((logger.get_level() >= Level::DEBUG), std::cerr, "D::{}::{}\n"_fmt(m_loc.get(), format), std::forward<Args>(args)...);
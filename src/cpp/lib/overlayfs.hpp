@@ -28,10 +28,13 @@ class Overlayfs
     fs::path m_path_dir_mountpoint;
 
   public:
+    // opt_path_dir_lower_top is stacked above the layers, e.g., for host files that should not
+    // be written to the upperdir
     Overlayfs(fs::path const& path_dir_layers
         , fs::path const& path_dir_modifications
         , fs::path const& path_dir_mountpoint
         , pid_t pid_to_die_for
+        , std::optional<fs::path> const& opt_path_dir_lower_top = std::nullopt
       )
       : m_path_dir_mountpoint(path_dir_mountpoint)
     {
@@ -43,6 +46,7 @@ class Overlayfs
         vec_path_dir_lowerdir.push_back(path_dir_lowerdir);
       } // for
       std::ranges::sort(vec_path_dir_lowerdir);
+      if ( opt_path_dir_lower_top ) { vec_path_dir_lowerdir.push_back(*opt_path_dir_lower_top); }
 
       ethrow_if (not fs::exists(path_dir_modifications) and not fs::create_directories(path_dir_modifications)
         , "Could not create modifications dir for overlayfs"
@@ -0,0 +1,211 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : reactor
+///
+
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "log.hpp"
+#include "../macro.hpp"
+
+namespace ns_reactor
+{
+
+namespace
+{
+
+// Size of each read from a pipe
+constexpr size_t const SIZE_BUFFER = 65536;
+
+// Longer lines are split, so a child that never writes a newline cannot grow memory
+constexpr size_t const SIZE_LINE_MAX = 65536;
+
+} // namespace
+
+// Incremented in the child of each fork, reactors created before it are not owned by the child
+inline std::atomic<uint64_t> forks{0};
+
+// class Reactor {{{
+// Drains the pipes of child processes in a single thread and dispatches their lines to handlers.
+// Handlers run synchronously on the reactor thread, so a slow handler stops the reads and the
+// child blocks on a full pipe instead of memory growing without bounds.
+class Reactor
+{
+  private:
+    struct Stream
+    {
+      std::function<void(std::string)> handler;
+      std::string line;
+    };
+    int m_fd_epoll;
+    int m_fd_event;
+    // Value of forks on creation, it differs in a forked child, which has no reactor thread
+    uint64_t m_forks;
+    std::mutex m_mutex;
+    std::unordered_map<int,std::shared_ptr<Stream>> m_streams;
+    std::unique_ptr<std::thread> m_thread;
+    void loop();
+    void drain(int fd, Stream& stream);
+    void remove(int fd, Stream& stream);
+
+  public:
+    Reactor();
+    ~Reactor();
+    Reactor(Reactor const&) = delete;
+    Reactor(Reactor&&) = delete;
+    Reactor& operator=(Reactor const&) = delete;
+    Reactor& operator=(Reactor&&) = delete;
+    void add(int fd, std::function<void(std::string)> handler);
+}; // class Reactor }}}
+
+// fn: Reactor::Reactor {{{
+inline Reactor::Reactor()
+  : m_fd_epoll(epoll_create1(EPOLL_CLOEXEC))
+  , m_fd_event(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+  , m_forks(forks)
+{
+  // A child that exits through exit() must not wake nor join the thread of the parent
+  pthread_atfork(nullptr, nullptr, []{ ++forks; });
+  ethrow_if(m_fd_epoll < 0, "Could not create epoll instance: {}"_fmt(strerror(errno)));
+  ethrow_if(m_fd_event < 0, "Could not create eventfd: {}"_fmt(strerror(errno)));
+  epoll_event event{ .events = EPOLLIN, .data = { .fd = m_fd_event } };
+  ethrow_if(epoll_ctl(m_fd_epoll, EPOLL_CTL_ADD, m_fd_event, &event) < 0
+    , "Could not watch eventfd: {}"_fmt(strerror(errno))
+  );
+  m_thread = std::make_unique<std::thread>([this]{ loop(); });
+} // fn: Reactor::Reactor }}}
+
+// fn: Reactor::~Reactor {{{
+inline Reactor::~Reactor()
+{
+  // Disowned in a forked child, the eventfd is shared with the parent and the thread does not
+  // exist, leak it instead of destroying a joinable thread
+  if ( m_forks != forks )
+  {
+    [[maybe_unused]] auto _ = m_thread.release();
+    return;
+  } // if
+  // Wake up the loop to exit
+  uint64_t value = 1;
+  [[maybe_unused]] ssize_t _ = write(m_fd_event, &value, sizeof(value));
+  if ( m_thread->joinable() ) { m_thread->join(); }
+  for (auto&& [fd, stream] : m_streams) { close(fd); }
+  close(m_fd_event);
+  close(m_fd_epoll);
+} // fn: Reactor::~Reactor }}}
+
+// fn: Reactor::add {{{
+// Takes ownership of fd, which is closed on end of file
+inline void Reactor::add(int fd, std::function<void(std::string)> handler)
+{
+  std::lock_guard lock(m_mutex);
+  m_streams.emplace(fd, std::make_shared<Stream>(Stream{ .handler = std::move(handler), .line = {} }));
+  epoll_event event{ .events = EPOLLIN, .data = { .fd = fd } };
+  if ( epoll_ctl(m_fd_epoll, EPOLL_CTL_ADD, fd, &event) < 0 )
+  {
+    ns_log::error()("Could not watch fd '{}': {}", fd, strerror(errno));
+    m_streams.erase(fd);
+    close(fd);
+  } // if
+} // fn: Reactor::add }}}
+
+// fn: Reactor::loop {{{
+inline void Reactor::loop()
+{
+  std::array<epoll_event,64> events;
+  while ( true )
+  {
+    int count = epoll_wait(m_fd_epoll, events.data(), events.size(), -1);
+    qcontinue_if(count < 0 and errno == EINTR);
+    ebreak_if(count < 0, "Reactor stopped: {}"_fmt(strerror(errno)));
+    for (int i = 0; i < count; ++i)
+    {
+      int fd = events[i].data.fd;
+      // Exit requested
+      qreturn_if(fd == m_fd_event);
+      // Find stream
+      std::shared_ptr<Stream> stream;
+      {
+        std::lock_guard lock(m_mutex);
+        auto it = m_streams.find(fd);
+        // Stop watching fds without a stream, otherwise a level-triggered fd spins the loop
+        if ( it == m_streams.end() )
+        {
+          epoll_ctl(m_fd_epoll, EPOLL_CTL_DEL, fd, nullptr);
+          continue;
+        } // if
+        stream = it->second;
+      }
+      drain(fd, *stream);
+    } // for
+  } // while
+} // fn: Reactor::loop }}}
+
+// fn: Reactor::drain {{{
+// Reads once from fd, so a busy pipe does not starve the others
+inline void Reactor::drain(int fd, Stream& stream)
+{
+  static thread_local std::array<char,SIZE_BUFFER> buffer;
+  ssize_t count = read(fd, buffer.data(), buffer.size());
+  qreturn_if(count < 0 and (errno == EINTR or errno == EAGAIN));
+  if ( count <= 0 )
+  {
+    remove(fd, stream);
+    return;
+  } // if
+  // Dispatch complete lines
+  std::string_view view(buffer.data(), count);
+  for (size_t pos = view.find('\n'); pos != std::string_view::npos; pos = view.find('\n'))
+  {
+    stream.line.append(view.substr(0, pos));
+    if ( not stream.line.empty() ) { stream.handler(stream.line); }
+    stream.line.clear();
+    view.remove_prefix(pos+1);
+  } // for
+  // Keep the incomplete line for the next read
+  stream.line.append(view);
+  if ( stream.line.size() >= SIZE_LINE_MAX )
+  {
+    stream.handler(stream.line);
+    stream.line.clear();
+  } // if
+} // fn: Reactor::drain }}}
+
+// fn: Reactor::remove {{{
+inline void Reactor::remove(int fd, Stream& stream)
+{
+  // Flush last line without a newline
+  if ( not stream.line.empty() ) { stream.handler(stream.line); }
+  epoll_ctl(m_fd_epoll, EPOLL_CTL_DEL, fd, nullptr);
+  // Erase before close, once closed add() might receive the same fd number
+  {
+    std::lock_guard lock(m_mutex);
+    m_streams.erase(fd);
+  }
+  close(fd);
+} // fn: Reactor::remove }}}
+
+// fn: reactor() {{{
+// Process-wide reactor, its thread starts on the first use
+inline Reactor& reactor()
+{
+  static Reactor reactor;
+  return reactor;
+} // fn: reactor() }}}
+
+} // namespace ns_reactor
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
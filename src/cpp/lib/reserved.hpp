@@ -5,68 +5,512 @@
 
 #pragma once
 
+#include <map>
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <cstdint>
+#include <cstring>
 #include <expected>
+#include <optional>
 #include <filesystem>
-#include <cstdint>
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <linux/falloc.h>
 #include "../common.hpp"
 #include "../macro.hpp"
+#include "log.hpp"
+
+// Reserved space of the binary, a header followed by one entry per field. Each entry is its type,
+// its count of slots and the space allocated to a value, followed by the slots. A slot is the
+// generation, length and checksum of a value, followed by the value. Fields are allocated after
+// the last entry when first written. Fields with two slots are updated by writing the slot of the
+// older generation, so an interrupted write leaves the previous value readable. The space
+// allocated to a value and not used by it is kept as a hole in the file. The end of the entries
+// is an entry with type zero.
+//
+// Binaries with the previous layout, with fields at fixed offsets, are converted on first access.
 
 namespace ns_reserved
 {
 
 namespace
 {
-  
+
 namespace fs = std::filesystem;
 
-} // namespace ns_reserved
+} // namespace
+
+// Size of the reserved space
+constexpr uint64_t const SIZE = 2097152;
+
+// Identifies the format and its version
+constexpr std::string_view const MAGIC = "FIMRSV01";
+
+// enum Field {{{
+enum class Field : uint32_t
+{
+  PERMISSIONS = 1,
+  NOTIFY = 2,
+  DESKTOP = 3,
+  ICON = 4,
+  CONFIG = 5,
+}; // enum Field }}}
+
+namespace
+{
+
+// struct Allocation {{{
+struct Allocation
+{
+  Field field;
+  uint64_t capacity;
+  uint32_t slots;
+}; // struct Allocation }}}
+
+// Space allocated to a value of each field and its count of slots, the icon does not fit twice
+constexpr std::array<Allocation,5> const ALLOCATION
+{{
+    {Field::PERMISSIONS, 8, 2}
+  , {Field::NOTIFY, 1, 2}
+  , {Field::DESKTOP, 4096, 2}
+  , {Field::ICON, 1048576, 1}
+  , {Field::CONFIG, 262144, 2}
+}};
+
+// struct Header {{{
+struct Header
+{
+  char magic[8];
+  uint64_t reserved;
+}; // struct Header }}}
+
+// struct Slot {{{
+// A slot is valid if its generation is not zero and the checksum matches its value
+struct Slot
+{
+  uint64_t generation;
+  uint64_t length;
+  uint32_t checksum;
+  uint32_t reserved;
+}; // struct Slot }}}
+
+// struct Entry {{{
+struct Entry
+{
+  uint32_t type;
+  uint32_t slots;
+  uint64_t capacity;
+
+  // Size of the entry and its slots
+  uint64_t size() const { return sizeof(Entry) + slots * (sizeof(Slot) + capacity); }
+}; // struct Entry }}}
+
+// fn: crc32() {{{
+inline uint32_t crc32(std::string_view data)
+{
+  static constexpr std::array<uint32_t,256> const table = []
+  {
+    std::array<uint32_t,256> table;
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j) { crc = (crc & 1)? (crc >> 1) ^ 0xEDB88320 : crc >> 1; }
+      table[i] = crc;
+    } // for
+    return table;
+  }();
+  uint32_t crc = 0xFFFFFFFF;
+  for (char c : data) { crc = table[(crc ^ static_cast<uint8_t>(c)) & 0xFF] ^ (crc >> 8); }
+  return crc ^ 0xFFFFFFFF;
+} // fn: crc32() }}}
+
+// fn: allocate() {{{
+// Entry of a field not yet written, with zero capacity for unknown fields
+inline Entry allocate(Field field)
+{
+  auto it = std::ranges::find(ALLOCATION, field, &Allocation::field);
+  qreturn_if(it == ALLOCATION.end(), (Entry{ .type = static_cast<uint32_t>(field), .slots = 1, .capacity = 0 }));
+  return Entry{ .type = static_cast<uint32_t>(field), .slots = it->slots, .capacity = it->capacity };
+} // fn: allocate() }}}
+
+// fn: serialize() {{{
+// A slot followed by its value
+inline std::string serialize(uint64_t generation, std::string_view value)
+{
+  Slot slot{ .generation = generation, .length = value.size(), .checksum = crc32(value), .reserved = 0 };
+  std::string data(sizeof(Slot), '\0');
+  std::memcpy(data.data(), &slot, sizeof(Slot));
+  data.append(value);
+  return data;
+} // fn: serialize() }}}
+
+// fn: convert() {{{
+// Converts the previous layout to the current one
+inline std::string convert(std::string_view data)
+{
+  std::string converted(SIZE, '\0');
+  std::memcpy(converted.data(), MAGIC.data(), MAGIC.size());
+  uint64_t offset = sizeof(Header);
+  auto f_add = [&](Field field, std::string_view value)
+  {
+    Entry entry = allocate(field);
+    std::memcpy(converted.data() + offset, &entry, sizeof(Entry));
+    std::string slot = serialize(1, value);
+    std::memcpy(converted.data() + offset + sizeof(Entry), slot.data(), slot.size());
+    offset += entry.size();
+  };
+  // Permission bits and notify byte
+  f_add(Field::PERMISSIONS, data.substr(0, 8));
+  f_add(Field::NOTIFY, data.substr(8, 1));
+  // Desktop json, terminated by a zero byte
+  std::string_view view_desktop = data.substr(9, 4096);
+  f_add(Field::DESKTOP, view_desktop.substr(0, view_desktop.find('\0')));
+  // Configuration json, preceded by its length
+  uint64_t length_config;
+  std::memcpy(&length_config, data.data() + 4105, sizeof(length_config));
+  if ( length_config > 0 and length_config <= allocate(Field::CONFIG).capacity - sizeof(length_config) )
+  {
+    f_add(Field::CONFIG, data.substr(4105 + sizeof(length_config), length_config));
+  } // if
+  // Icon, the extension, the data and the size of the data in the last megabyte
+  std::string_view view_icon = data.substr(SIZE - 1048576);
+  uint64_t size_icon;
+  std::memcpy(&size_icon, view_icon.data() + view_icon.size() - sizeof(size_icon), sizeof(size_icon));
+  if ( size_icon > 0 and size_icon <= view_icon.size() - 12 )
+  {
+    f_add(Field::ICON, std::string{view_icon.substr(0, 4)} + std::string{view_icon.substr(4, size_icon)});
+  } // if
+  return converted;
+} // fn: convert() }}}
+
+// class Lock {{{
+// Lock of the binary across processes, exclusive while the layout or a value is modified and
+// shared while a value is read
+class Lock
+{
+  private:
+    int m_fd;
+  public:
+    explicit Lock(int fd, int operation = LOCK_EX) : m_fd(fd)
+    {
+      while ( flock(m_fd, operation) < 0 and errno == EINTR ) {}
+    }
+    ~Lock() { flock(m_fd, LOCK_UN); }
+    Lock(Lock const&) = delete;
+    Lock& operator=(Lock const&) = delete;
+}; // class Lock }}}
+
+} // namespace
+
+// class Reserved {{{
+// Reserved space of a binary, mapped to memory
+class Reserved
+{
+  private:
+    int m_fd;
+    bool m_is_writable;
+    uint64_t m_offset;
+    void* m_map;
+    size_t m_size_map;
+    // Reserved space in the mapping, or in m_converted if it could not be converted in the binary
+    std::string m_converted;
+    std::string_view m_data;
+    // Locks of the binary are shared by the threads of the process, which are excluded here
+    mutable std::shared_mutex m_mutex;
+
+    std::optional<uint64_t> find(Field field) const;
+    uint64_t end() const;
+    std::optional<uint32_t> current(uint64_t pos, Entry const& entry) const;
+    void punch(uint64_t begin, uint64_t end);
+    std::expected<std::string_view,std::string> read_locked(Field field) const;
+    std::error<std::string> write_locked(Field field, std::string_view value);
+
+  public:
+    Reserved(fs::path const& path_file_binary, uint64_t offset);
+    ~Reserved();
+    Reserved(Reserved const&) = delete;
+    Reserved(Reserved&&) = delete;
+    Reserved& operator=(Reserved const&) = delete;
+    Reserved& operator=(Reserved&&) = delete;
 
-// write() {{{
-// Writes data to file in binary format
-// Returns space left after write
-[[nodiscard]] inline std::error<std::string> write(fs::path const& path_file_binary
-  , uint64_t offset
-  , uint64_t size
-  , const char* data
-  , uint64_t length)
-{
-  qreturn_if(length > size, std::make_optional("Size of data exceeds available space"));
-  // Open output binary file
-  std::ofstream file_binary(path_file_binary, std::ios::binary | std::ios::in | std::ios::out);
-  qreturn_if(not file_binary.is_open(), std::make_optional("Failed to open input file"));
-  // Write blank data
-  std::vector<char> blank(size, 0);
-  qreturn_if(not file_binary.seekp(offset), std::make_optional("Failed to seek offset to blank"));
-  qreturn_if(not file_binary.write(blank.data(), size), std::make_optional("Failed to write blank data"));
-  // Write data with length
-  qreturn_if(not file_binary.seekp(offset), std::make_optional("Failed to seek offset to write data"));
-  qreturn_if(not file_binary.write(data, length), std::make_optional("Failed to write data"));
-  // Success
+    // Value of the field, empty if it was not written and an error if it is damaged
+    [[nodiscard]] std::expected<std::string,std::string> read(Field field) const;
+    [[nodiscard]] std::error<std::string> write(Field field, std::string_view value);
+    // Replaces the value of the field with f(value), no other process writes in between
+    template<typename F>
+    [[nodiscard]] std::error<std::string> update(Field field, F&& f);
+}; // class Reserved }}}
+
+// fn: Reserved::Reserved {{{
+inline Reserved::Reserved(fs::path const& path_file_binary, uint64_t offset)
+  : m_fd(open(path_file_binary.c_str(), O_RDWR | O_CLOEXEC))
+  , m_is_writable(m_fd >= 0)
+  , m_offset(offset)
+  , m_map(MAP_FAILED)
+  , m_size_map(0)
+{
+  // Read-only binaries are still readable
+  if ( m_fd < 0 ) { m_fd = open(path_file_binary.c_str(), O_RDONLY | O_CLOEXEC); }
+  ethrow_if(m_fd < 0, "Could not open '{}': {}"_fmt(path_file_binary, strerror(errno)));
+  // Mapped pages past the end of the file are not accessible
+  struct stat st;
+  if ( fstat(m_fd, &st) < 0 or static_cast<uint64_t>(st.st_size) < offset + SIZE )
+  {
+    close(m_fd);
+    "Binary '{}' has no reserved space at offset '{}'"_throw(path_file_binary, offset);
+  } // if
+  // The mapping starts at a page boundary
+  uint64_t offset_page = offset - offset % sysconf(_SC_PAGESIZE);
+  m_size_map = SIZE + (offset - offset_page);
+  m_map = mmap(nullptr, m_size_map, PROT_READ, MAP_SHARED, m_fd, offset_page);
+  if ( m_map == MAP_FAILED )
+  {
+    close(m_fd);
+    "Could not map reserved space of '{}': {}"_throw(path_file_binary, strerror(errno));
+  } // if
+  m_data = std::string_view(static_cast<char const*>(m_map) + (offset - offset_page), SIZE);
+  // Convert from the previous layout, checked again with the lock as another process may convert it
+  qreturn_if(m_data.starts_with(MAGIC));
+  Lock lock(m_fd);
+  qreturn_if(m_data.starts_with(MAGIC));
+  ns_log::debug()("Converting reserved space of '{}'", path_file_binary);
+  m_converted = convert(m_data);
+  if ( m_is_writable and pwrite(m_fd, m_converted.data(), m_converted.size(), m_offset) == static_cast<ssize_t>(m_converted.size()) )
+  {
+    m_converted.clear();
+    // Release the space not used by the values, only the first slot is written
+    for (uint64_t pos = sizeof(Header); pos + sizeof(Entry) <= SIZE;)
+    {
+      Entry entry;
+      Slot slot;
+      std::memcpy(&entry, m_data.data() + pos, sizeof(Entry));
+      qbreak_if(entry.type == 0);
+      std::memcpy(&slot, m_data.data() + pos + sizeof(Entry), sizeof(Slot));
+      punch(pos + sizeof(Entry) + sizeof(Slot) + slot.length, pos + entry.size());
+      pos += entry.size();
+    } // for
+    punch(end(), SIZE);
+  } // if
+  else
+  {
+    ns_log::debug()("Could not convert reserved space in the binary");
+    m_data = m_converted;
+  } // else
+} // fn: Reserved::Reserved }}}
+
+// fn: Reserved::~Reserved {{{
+inline Reserved::~Reserved()
+{
+  if ( m_map != MAP_FAILED ) { munmap(m_map, m_size_map); }
+  if ( m_fd >= 0 ) { close(m_fd); }
+} // fn: Reserved::~Reserved }}}
+
+// fn: Reserved::find {{{
+// Position of the entry of field
+inline std::optional<uint64_t> Reserved::find(Field field) const
+{
+  for (uint64_t pos = sizeof(Header); pos + sizeof(Entry) <= SIZE;)
+  {
+    Entry entry;
+    std::memcpy(&entry, m_data.data() + pos, sizeof(Entry));
+    qbreak_if(entry.type == 0);
+    qreturn_if(entry.type == static_cast<uint32_t>(field), pos);
+    pos += entry.size();
+  } // for
+  return std::nullopt;
+} // fn: Reserved::find }}}
+
+// fn: Reserved::end {{{
+// Position after the last entry
+inline uint64_t Reserved::end() const
+{
+  uint64_t pos = sizeof(Header);
+  while ( pos + sizeof(Entry) <= SIZE )
+  {
+    Entry entry;
+    std::memcpy(&entry, m_data.data() + pos, sizeof(Entry));
+    qbreak_if(entry.type == 0);
+    pos += entry.size();
+  } // while
+  return pos;
+} // fn: Reserved::end }}}
+
+// fn: Reserved::current {{{
+// Index of the valid slot with the latest generation of the entry at pos
+inline std::optional<uint32_t> Reserved::current(uint64_t pos, Entry const& entry) const
+{
+  std::optional<uint32_t> opt_index;
+  uint64_t generation = 0;
+  for (uint32_t i = 0; i < entry.slots; ++i)
+  {
+    uint64_t pos_slot = pos + sizeof(Entry) + i * (sizeof(Slot) + entry.capacity);
+    qbreak_if(pos_slot + sizeof(Slot) + entry.capacity > SIZE);
+    Slot slot;
+    std::memcpy(&slot, m_data.data() + pos_slot, sizeof(Slot));
+    qcontinue_if(slot.generation <= generation or slot.length > entry.capacity);
+    qcontinue_if(crc32(m_data.substr(pos_slot + sizeof(Slot), slot.length)) != slot.checksum);
+    generation = slot.generation;
+    opt_index = i;
+  } // for
+  return opt_index;
+} // fn: Reserved::current }}}
+
+// fn: Reserved::punch {{{
+// Deallocates the pages between the positions begin and end, which then read as zeros
+inline void Reserved::punch(uint64_t begin, uint64_t end)
+{
+  uint64_t size_page = sysconf(_SC_PAGESIZE);
+  uint64_t offset_begin = (m_offset + begin + size_page - 1) / size_page * size_page;
+  uint64_t offset_end = (m_offset + end) / size_page * size_page;
+  qreturn_if(offset_begin >= offset_end);
+  elog_if(fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset_begin, offset_end - offset_begin) < 0
+    , "Could not release reserved space: {}"_fmt(strerror(errno))
+  );
+} // fn: Reserved::punch }}}
+
+// fn: Reserved::read_locked {{{
+// Value of the field in the mapping, valid while the lock is held
+inline std::expected<std::string_view,std::string> Reserved::read_locked(Field field) const
+{
+  auto opt_pos = find(field);
+  qreturn_if(not opt_pos, std::string_view{});
+  Entry entry;
+  std::memcpy(&entry, m_data.data() + *opt_pos, sizeof(Entry));
+  // A field with no valid slot is not treated as absent, which would overwrite it with defaults
+  auto opt_index = current(*opt_pos, entry);
+  qreturn_if(not opt_index, std::unexpected("Reserved field '{}' is damaged"_fmt(entry.type)));
+  uint64_t pos_slot = *opt_pos + sizeof(Entry) + *opt_index * (sizeof(Slot) + entry.capacity);
+  Slot slot;
+  std::memcpy(&slot, m_data.data() + pos_slot, sizeof(Slot));
+  return m_data.substr(pos_slot + sizeof(Slot), slot.length);
+} // fn: Reserved::read_locked }}}
+
+// fn: Reserved::read {{{
+inline std::expected<std::string,std::string> Reserved::read(Field field) const
+{
+  // Another process may be writing to the mapping
+  std::shared_lock lock_thread(m_mutex);
+  Lock lock(m_fd, LOCK_SH);
+  auto expected = read_locked(field);
+  qreturn_if(not expected, std::unexpected(expected.error()));
+  return std::string{*expected};
+} // fn: Reserved::read }}}
+
+// fn: Reserved::write_locked {{{
+inline std::error<std::string> Reserved::write_locked(Field field, std::string_view value)
+{
+  // Find the entry of the field or allocate a novel one
+  Entry entry;
+  uint64_t pos;
+  std::string data;
+  if ( auto opt_pos = find(field) )
+  {
+    pos = *opt_pos;
+    std::memcpy(&entry, m_data.data() + pos, sizeof(Entry));
+    qreturn_if(entry.slots == 0, "Reserved field '{}' has no slots"_fmt(entry.type));
+    // Overwrite the slot after the current one, or the first slot if none is valid
+    auto opt_index = current(pos, entry);
+    uint32_t index = (opt_index)? (*opt_index + 1) % entry.slots : 0;
+    uint64_t generation = 1;
+    if ( opt_index )
+    {
+      Slot slot;
+      std::memcpy(&slot, m_data.data() + pos + sizeof(Entry) + *opt_index * (sizeof(Slot) + entry.capacity), sizeof(Slot));
+      generation = slot.generation + 1;
+    } // if
+    pos += sizeof(Entry) + index * (sizeof(Slot) + entry.capacity);
+    data = serialize(generation, value);
+  } // if
+  else
+  {
+    pos = end();
+    entry = allocate(field);
+    qreturn_if(entry.capacity == 0, "Unknown reserved field '{}'"_fmt(static_cast<uint32_t>(field)));
+    qreturn_if(pos + entry.size() > SIZE, "Not enough reserved space for field '{}'"_fmt(static_cast<uint32_t>(field)));
+    // The entry and its first slot are written at once
+    data = std::string(sizeof(Entry), '\0');
+    std::memcpy(data.data(), &entry, sizeof(Entry));
+    data.append(serialize(1, value));
+  } // else
+  qreturn_if(value.size() > entry.capacity, "Size of data exceeds available space");
+  qreturn_if(pwrite(m_fd, data.data(), data.size(), m_offset + pos) != static_cast<ssize_t>(data.size())
+    , "Failed to write reserved field: {}"_fmt(strerror(errno))
+  );
+  // Release the space of the previous value of the slot
+  uint64_t pos_value = pos + data.size() - value.size();
+  punch(pos_value + value.size(), pos_value + entry.capacity);
   return std::nullopt;
-} // write() }}}
-
-// read() {{{
-// Reads data from a file in binary format
-// Returns a std::string built with the data
-[[nodiscard]] inline std::expected<uint64_t,std::string> read(fs::path const& path_file_binary
-  , uint64_t offset
-  , uint64_t length
-  , char* data)
-{
-  // Open binary file
-  std::ifstream file_binary(path_file_binary, std::ios::binary | std::ios::in);
-  qreturn_if(not file_binary.is_open(), std::unexpected("Failed to open input file"));
-  // Advance towards data
-  qreturn_if(not file_binary.seekg(offset), std::unexpected("Failed to seek to file offset for read"));
-  // Read data
-  qreturn_if(not file_binary.read(data, length), std::unexpected("Failed to read data from binary file"));
-  // Check how many bytes were actually read
-  std::streamsize bytes_read = file_binary.gcount();
-  // Return number of read bytes
-  return bytes_read;
-} // read() }}}
-
-} // namespace 
+} // fn: Reserved::write_locked }}}
+
+// fn: Reserved::write {{{
+inline std::error<std::string> Reserved::write(Field field, std::string_view value)
+{
+  qreturn_if(not m_is_writable or not m_converted.empty(), "Binary is not writable");
+  // Entries allocated by other processes are visible in the shared mapping once the lock is held
+  std::unique_lock lock_thread(m_mutex);
+  Lock lock(m_fd);
+  return write_locked(field, value);
+} // fn: Reserved::write }}}
+
+// fn: Reserved::update {{{
+template<typename F>
+std::error<std::string> Reserved::update(Field field, F&& f)
+{
+  qreturn_if(not m_is_writable or not m_converted.empty(), "Binary is not writable");
+  std::unique_lock lock_thread(m_mutex);
+  Lock lock(m_fd);
+  auto expected = read_locked(field);
+  qreturn_if(not expected, expected.error());
+  // The value is copied, as writing may punch the pages it is in
+  std::string value = f(std::string{*expected});
+  return write_locked(field, value);
+} // fn: Reserved::update }}}
+
+namespace
+{
+
+// struct Mapped {{{
+// Reserved spaces mapped by the process
+struct Mapped
+{
+  std::mutex mutex;
+  std::map<std::pair<std::string,uint64_t>,std::unique_ptr<Reserved>> map_reserved;
+}; // struct Mapped }}}
+
+// fn: mapped() {{{
+inline Mapped& mapped()
+{
+  static Mapped mapped;
+  return mapped;
+} // fn: mapped() }}}
+
+} // namespace
+
+// fn: get() {{{
+// Reserved space of the binary, mapped once until release()
+inline Reserved& get(fs::path const& path_file_binary, uint64_t offset)
+{
+  Mapped& mapped = ns_reserved::mapped();
+  std::lock_guard lock(mapped.mutex);
+  auto& ptr_reserved = mapped.map_reserved[{path_file_binary.string(), offset}];
+  if ( not ptr_reserved ) { ptr_reserved = std::make_unique<Reserved>(path_file_binary, offset); }
+  return *ptr_reserved;
+} // fn: get() }}}
+
+// fn: release() {{{
+// Unmaps and closes the reserved spaces, references returned by get() are invalidated
+inline void release()
+{
+  Mapped& mapped = ns_reserved::mapped();
+  std::lock_guard lock(mapped.mutex);
+  mapped.map_reserved.clear();
+} // fn: release() }}}
+
+} // namespace ns_reserved
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
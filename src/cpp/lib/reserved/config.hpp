@@ -0,0 +1,53 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : config
+///
+
+#pragma once
+
+#include <string>
+#include <filesystem>
+#include "../reserved.hpp"
+#include "../../macro.hpp"
+
+// Configuration json stored in the binary, empty if it was not yet moved from the filesystem to
+// the binary and an error if it is damaged
+
+namespace ns_reserved::ns_config
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+}
+
+// write() {{{
+inline std::error<std::string> write(fs::path const& path_file_binary
+  , uint64_t offset
+  , std::string_view json
+)
+{
+  return ns_reserved::get(path_file_binary, offset).write(Field::CONFIG, json);
+} // write() }}}
+
+// read() {{{
+inline std::expected<std::string,std::string> read(fs::path const& path_file_binary, uint64_t offset)
+{
+  auto expected_read = ns_reserved::get(path_file_binary, offset).read(Field::CONFIG);
+  qreturn_if(not expected_read, std::unexpected(expected_read.error()));
+  return *expected_read;
+} // read() }}}
+
+// update() {{{
+// Replaces the json with f(json) while holding the lock of the binary
+template<typename F>
+inline std::error<std::string> update(fs::path const& path_file_binary, uint64_t offset, F&& f)
+{
+  return ns_reserved::get(path_file_binary, offset).update(Field::CONFIG, std::forward<F>(f));
+} // update() }}}
+
+} // namespace ns_reserved::ns_config
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -23,27 +23,47 @@ namespace fs = std::filesystem;
 // write() {{{
 inline std::error<std::string> write(fs::path const& path_file_binary
   , uint64_t offset
-  , uint64_t size
-  , const char* raw_json
-  , uint64_t length
+  , std::string_view raw_json
 )
 {
-  qreturn_if(length > size, "Not enough space to fit json data");
-  return ns_reserved::write(path_file_binary, offset, size, raw_json, length);
+  return ns_reserved::get(path_file_binary, offset).write(Field::DESKTOP, raw_json);
 } // write() }}}
 
 // read() {{{
-inline std::expected<std::unique_ptr<char[]>,std::string> read(fs::path const& path_file_binary
-  , uint64_t offset
-  , uint64_t size)
+inline std::expected<std::string,std::string> read(fs::path const& path_file_binary, uint64_t offset)
 {
-  std::string raw_json;
-  auto buffer = std::make_unique<char[]>(size);
-  auto expected_read = ns_reserved::read(path_file_binary, offset, size, buffer.get());
+  auto expected_read = ns_reserved::get(path_file_binary, offset).read(Field::DESKTOP);
   qreturn_if(not expected_read, std::unexpected(expected_read.error()));
-  return buffer;
+  return *expected_read;
 } // read() }}}
 
+// write_icon() {{{
+// The icon is its extension in four bytes, followed by the image data
+inline std::error<std::string> write_icon(fs::path const& path_file_binary
+  , uint64_t offset
+  , std::string_view ext
+  , std::string_view data
+)
+{
+  qreturn_if(ext.size() > 3, "Invalid icon extension '{}'"_fmt(ext));
+  std::string icon(4, '\0');
+  std::ranges::copy(ext, icon.begin());
+  icon.append(data);
+  return ns_reserved::get(path_file_binary, offset).write(Field::ICON, icon);
+} // write_icon() }}}
+
+// read_icon() {{{
+// Pair of the extension and data of the icon
+inline std::expected<std::pair<std::string,std::string>,std::string> read_icon(fs::path const& path_file_binary
+  , uint64_t offset)
+{
+  auto expected_read = ns_reserved::get(path_file_binary, offset).read(Field::ICON);
+  qreturn_if(not expected_read, std::unexpected(expected_read.error()));
+  qreturn_if(expected_read->size() <= 4, std::unexpected("No icon in the binary"));
+  std::string ext = expected_read->substr(0, 4);
+  return std::make_pair(std::string{ext.substr(0, ext.find('\0'))}, expected_read->substr(4));
+} // read_icon() }}}
+
 } // namespace ns_reserved::ns_desktop
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
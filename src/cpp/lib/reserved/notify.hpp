@@ -23,21 +23,19 @@ namespace fs = std::filesystem;
 // write() {{{
 inline std::error<std::string> write(fs::path const& path_file_binary
   , uint64_t offset
-  , uint64_t size
   , char value
 )
 {
-  qreturn_if(size < 1, "Not enough space to fit json data");
-  return ns_reserved::write(path_file_binary, offset, size, &value, sizeof(char));
+  return ns_reserved::get(path_file_binary, offset).write(Field::NOTIFY, std::string_view(&value, sizeof(value)));
 } // write() }}}
 
 // read() {{{
+// Notify is disabled if the field was not written
 inline std::expected<char,std::string> read(fs::path const& path_file_binary, uint64_t offset)
 {
-  char buffer;
-  auto expected_read = ns_reserved::read(path_file_binary, offset, sizeof(buffer), &buffer);
+  auto expected_read = ns_reserved::get(path_file_binary, offset).read(Field::NOTIFY);
   qreturn_if(not expected_read, std::unexpected(expected_read.error()));
-  return buffer;
+  return (expected_read->empty())? 0 : expected_read->front();
 } // read() }}}
 
 } // namespace ns_reserved::ns_notify
@@ -74,24 +74,24 @@ struct Bits
 // write() {{{
 inline std::optional<std::string> write(fs::path const& path_file_binary
   , uint64_t offset
-  , uint64_t size
   , Bits bits
 )
 {
-  return ns_reserved::write(path_file_binary, offset, size, reinterpret_cast<char*>(&bits), sizeof(bits));
+  return ns_reserved::get(path_file_binary, offset)
+    .write(Field::PERMISSIONS, std::string_view(reinterpret_cast<char*>(&bits), sizeof(bits)));
 } // write() }}}
 
 // read() {{{
+// No permissions are set if the field was not written
 inline std::expected<Bits,std::string> read(fs::path const& path_file_binary
-  , uint64_t offset
-  , uint64_t size)
+  , uint64_t offset)
 {
   Bits bits;
-  char buffer[sizeof(Bits)];
-  qreturn_if(sizeof(Bits) > size, std::unexpected("Not enough space for read"));
-  auto expected_read = ns_reserved::read(path_file_binary, offset, sizeof(bits), buffer);
+  auto expected_read = ns_reserved::get(path_file_binary, offset).read(Field::PERMISSIONS);
   qreturn_if(not expected_read, std::unexpected(expected_read.error()));
-  std::memcpy(&bits, buffer, sizeof(bits));
+  qreturn_if(expected_read->empty(), bits);
+  qreturn_if(expected_read->size() != sizeof(bits), std::unexpected("Invalid size of permission bits"));
+  std::memcpy(&bits, expected_read->data(), sizeof(bits));
   return bits;
 } // read() }}}
 
@@ -100,54 +100,51 @@ class Permissions
 {
   private:
     fs::path const& m_path_file_binary;
-    int64_t m_offset;
-    int64_t m_size;
+    uint64_t m_offset;
   public:
     Permissions(fs::path const& path_file_binary
-      , int64_t begin
-      , int64_t end
+      , uint64_t offset
     ) : m_path_file_binary(path_file_binary)
-      , m_offset(begin)
-      , m_size(end)
+      , m_offset(offset)
     {}
     template<ns_concept::Iterable R>
     inline void set(R&& r)
     {
       Bits bits;
       std::ranges::for_each(r, [&](auto&& e){ bits.set(e, true); });
-      auto error = write(m_path_file_binary, m_offset, m_size, bits);
+      auto error = write(m_path_file_binary, m_offset, bits);
       ereturn_if(error, "Error to write permission bits: {}"_fmt(*error));
     }
 
     template<ns_concept::Iterable R>
     inline void add(R&& r)
     {
-      auto expected = read(m_path_file_binary, m_offset, m_size);
+      auto expected = read(m_path_file_binary, m_offset);
       ereturn_if(not expected, "Could not read permission bits: {}"_fmt(expected.error()));
       std::ranges::for_each(r, [&](auto&& e){ expected->set(e, true); });
-      auto error = write(m_path_file_binary, m_offset, m_size, *expected);
+      auto error = write(m_path_file_binary, m_offset, *expected);
       ereturn_if(error, "Error to write permission bits: {}"_fmt(*error));
     }
 
     template<ns_concept::Iterable R>
     inline void del(R&& r)
     {
-      auto expected = read(m_path_file_binary, m_offset, m_size);
+      auto expected = read(m_path_file_binary, m_offset);
       ereturn_if(not expected, "Could not read permission bits: {}"_fmt(expected.error()));
       std::ranges::for_each(r, [&](auto&& e){ expected->set(e, false); });
-      auto error = write(m_path_file_binary, m_offset, m_size, *expected);
+      auto error = write(m_path_file_binary, m_offset, *expected);
       ereturn_if(error, "Error to write permission bits: {}"_fmt(*error));
     }
 
     inline std::expected<Bits, std::string> get()
     {
-      return read(m_path_file_binary, m_offset, m_size);
+      return read(m_path_file_binary, m_offset);
     }
 
     inline std::vector<std::string> to_vector_string()
     {
       std::vector<std::string> out;
-      auto expected = read(m_path_file_binary, m_offset, m_size);
+      auto expected = read(m_path_file_binary, m_offset);
       ereturn_if(not expected, "Failed to read permissions: {}"_fmt(expected.error()), out);
       return expected->to_vector_string();
     }
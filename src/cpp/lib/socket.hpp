@@ -0,0 +1,287 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : socket
+///
+
+#pragma once
+
+#include <span>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "log.hpp"
+#include "../macro.hpp"
+
+namespace ns_socket
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+// Largest frame accepted, requests carry argv and the environment
+constexpr uint32_t const SIZE_FRAME_MAX = 16 << 20;
+
+// Most file descriptors passed with a frame
+constexpr size_t const COUNT_FDS_MAX = 16;
+
+// fn: make_address() {{{
+inline std::expected<sockaddr_un, std::string> make_address(fs::path const& path_file_socket)
+{
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  qreturn_if(path_file_socket.string().size() >= sizeof(address.sun_path)
+    , std::unexpected("Socket path is too long: '{}'"_fmt(path_file_socket))
+  );
+  std::strncpy(address.sun_path, path_file_socket.c_str(), sizeof(address.sun_path) - 1);
+  return address;
+} // fn: make_address() }}}
+
+// fn: write_all() {{{
+inline bool write_all(int fd, char const* data, size_t size)
+{
+  while ( size > 0 )
+  {
+    ssize_t count = send(fd, data, size, MSG_NOSIGNAL);
+    qcontinue_if(count < 0 and errno == EINTR);
+    qreturn_if(count <= 0, false);
+    data += count;
+    size -= count;
+  } // while
+  return true;
+} // fn: write_all() }}}
+
+// fn: read_all() {{{
+inline bool read_all(int fd, char* data, size_t size)
+{
+  while ( size > 0 )
+  {
+    ssize_t count = recv(fd, data, size, 0);
+    qcontinue_if(count < 0 and errno == EINTR);
+    qreturn_if(count <= 0, false);
+    data += count;
+    size -= count;
+  } // while
+  return true;
+} // fn: read_all() }}}
+
+} // namespace
+
+// fn: listen() {{{
+// Creates a listening socket at path_file_socket, replacing a stale one
+inline std::expected<int, std::string> listen(fs::path const& path_file_socket)
+{
+  auto expected_address = make_address(path_file_socket);
+  qreturn_if(not expected_address, std::unexpected(expected_address.error()));
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  qreturn_if(fd < 0, std::unexpected("Could not create socket: {}"_fmt(strerror(errno))));
+  unlink(path_file_socket.c_str());
+  if ( bind(fd, reinterpret_cast<sockaddr*>(&*expected_address), sizeof(sockaddr_un)) < 0
+    or ::listen(fd, SOMAXCONN) < 0 )
+  {
+    std::string error = strerror(errno);
+    close(fd);
+    return std::unexpected("Could not listen on '{}': {}"_fmt(path_file_socket, error));
+  } // if
+  return fd;
+} // fn: listen() }}}
+
+// fn: connect() {{{
+inline std::expected<int, std::string> connect(fs::path const& path_file_socket)
+{
+  auto expected_address = make_address(path_file_socket);
+  qreturn_if(not expected_address, std::unexpected(expected_address.error()));
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  qreturn_if(fd < 0, std::unexpected("Could not create socket: {}"_fmt(strerror(errno))));
+  if ( ::connect(fd, reinterpret_cast<sockaddr*>(&*expected_address), sizeof(sockaddr_un)) < 0 )
+  {
+    std::string error = strerror(errno);
+    close(fd);
+    return std::unexpected("Could not connect to '{}': {}"_fmt(path_file_socket, error));
+  } // if
+  return fd;
+} // fn: connect() }}}
+
+// fn: wait() {{{
+// Waits for fd to become readable, returns false on timeout
+inline std::expected<bool, std::string> wait(int fd, std::chrono::milliseconds timeout)
+{
+  pollfd fd_poll{ .fd = fd, .events = POLLIN, .revents = 0 };
+  auto time_deadline = std::chrono::steady_clock::now() + timeout;
+  while ( true )
+  {
+    auto time_left = std::chrono::duration_cast<std::chrono::milliseconds>(time_deadline - std::chrono::steady_clock::now());
+    int ret = poll(&fd_poll, 1, std::max<int64_t>(time_left.count(), 0));
+    qcontinue_if(ret < 0 and errno == EINTR);
+    qreturn_if(ret < 0, std::unexpected("Could not poll socket: {}"_fmt(strerror(errno))));
+    return ret > 0;
+  } // while
+} // fn: wait() }}}
+
+// fn: send() {{{
+// Sends a frame as a 32-bit length and the payload, fds are attached to the first byte
+inline std::expected<void, std::string> send(int fd, std::string_view payload, std::span<int const> fds = {})
+{
+  qreturn_if(payload.size() > SIZE_FRAME_MAX, std::unexpected("Frame is too large"));
+  qreturn_if(fds.size() > COUNT_FDS_MAX, std::unexpected("Too many file descriptors"));
+  uint32_t size = payload.size();
+  // Send length with the file descriptors
+  iovec iov{ .iov_base = &size, .iov_len = sizeof(size) };
+  alignas(cmsghdr) char buffer_control[CMSG_SPACE(sizeof(int) * COUNT_FDS_MAX)]{};
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  if ( not fds.empty() )
+  {
+    message.msg_control = buffer_control;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+  } // if
+  ssize_t count;
+  do { count = sendmsg(fd, &message, MSG_NOSIGNAL); } while ( count < 0 and errno == EINTR );
+  qreturn_if(count < 0, std::unexpected("Could not send frame: {}"_fmt(strerror(errno))));
+  // Rest of the length and the payload
+  qreturn_if(not write_all(fd, reinterpret_cast<char const*>(&size) + count, sizeof(size) - count)
+    or not write_all(fd, payload.data(), payload.size())
+    , std::unexpected("Could not send frame: {}"_fmt(strerror(errno)))
+  );
+  return {};
+} // fn: send() }}}
+
+// fn: recv() {{{
+// Receives a frame, passed file descriptors are appended to vec_fds with close-on-exec set
+inline std::expected<std::string, std::string> recv(int fd, std::vector<int>* vec_fds = nullptr)
+{
+  uint32_t size{};
+  iovec iov{ .iov_base = &size, .iov_len = sizeof(size) };
+  alignas(cmsghdr) char buffer_control[CMSG_SPACE(sizeof(int) * COUNT_FDS_MAX)]{};
+  msghdr message{};
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = buffer_control;
+  message.msg_controllen = sizeof(buffer_control);
+  ssize_t count;
+  do { count = recvmsg(fd, &message, MSG_CMSG_CLOEXEC); } while ( count < 0 and errno == EINTR );
+  qreturn_if(count < 0, std::unexpected("Could not receive frame: {}"_fmt(strerror(errno))));
+  qreturn_if(count == 0, std::unexpected("Connection closed"));
+  // Collect file descriptors, close them if the caller does not want them
+  for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+  {
+    qcontinue_if(header->cmsg_level != SOL_SOCKET or header->cmsg_type != SCM_RIGHTS);
+    size_t count_fds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count_fds; ++i)
+    {
+      int fd_received;
+      std::memcpy(&fd_received, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+      if ( vec_fds ) { vec_fds->push_back(fd_received); } else { close(fd_received); }
+    } // for
+  } // for
+  // Rest of the length and the payload
+  qreturn_if(not read_all(fd, reinterpret_cast<char*>(&size) + count, sizeof(size) - count)
+    , std::unexpected("Could not receive frame length")
+  );
+  qreturn_if(size > SIZE_FRAME_MAX, std::unexpected("Frame is too large"));
+  std::string payload(size, '\0');
+  qreturn_if(not read_all(fd, payload.data(), payload.size())
+    , std::unexpected("Could not receive frame payload")
+  );
+  return payload;
+} // fn: recv() }}}
+
+// class Receiver {{{
+// Collects a frame from a non-blocking socket across readiness events, passed file descriptors
+// are closed if the frame is not taken
+class Receiver
+{
+  private:
+    uint32_t m_size;
+    size_t m_count_size;
+    std::string m_payload;
+    size_t m_count_payload;
+    std::vector<int> m_fds;
+
+  public:
+    Receiver() : m_size(0), m_count_size(0), m_payload(), m_count_payload(0), m_fds() {}
+    ~Receiver() { std::ranges::for_each(m_fds, [](int fd){ close(fd); }); }
+    Receiver(Receiver const&) = delete;
+    Receiver(Receiver&&) = delete;
+    Receiver& operator=(Receiver const&) = delete;
+    Receiver& operator=(Receiver&&) = delete;
+
+    // Reads what is available, returns true once the frame is complete
+    [[nodiscard]] std::expected<bool, std::string> read(int fd);
+    // Payload and file descriptors of a complete frame
+    [[nodiscard]] std::pair<std::string, std::vector<int>> take();
+}; // class Receiver }}}
+
+// fn: Receiver::read() {{{
+inline std::expected<bool, std::string> Receiver::read(int fd)
+{
+  while ( m_count_size < sizeof(m_size) or m_count_payload < m_payload.size() )
+  {
+    // Length, then the payload once the length is known
+    iovec iov = ( m_count_size < sizeof(m_size) )?
+        iovec{ .iov_base = reinterpret_cast<char*>(&m_size) + m_count_size, .iov_len = sizeof(m_size) - m_count_size }
+      : iovec{ .iov_base = m_payload.data() + m_count_payload, .iov_len = m_payload.size() - m_count_payload };
+    alignas(cmsghdr) char buffer_control[CMSG_SPACE(sizeof(int) * COUNT_FDS_MAX)]{};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = buffer_control;
+    message.msg_controllen = sizeof(buffer_control);
+    ssize_t count = recvmsg(fd, &message, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    qcontinue_if(count < 0 and errno == EINTR);
+    qreturn_if(count < 0 and (errno == EAGAIN or errno == EWOULDBLOCK), false);
+    qreturn_if(count < 0, std::unexpected("Could not receive frame: {}"_fmt(strerror(errno))));
+    // Collect file descriptors, past the limit they are closed
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+    {
+      qcontinue_if(header->cmsg_level != SOL_SOCKET or header->cmsg_type != SCM_RIGHTS);
+      size_t count_fds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < count_fds; ++i)
+      {
+        int fd_received;
+        std::memcpy(&fd_received, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+        if ( m_fds.size() < COUNT_FDS_MAX ) { m_fds.push_back(fd_received); } else { close(fd_received); }
+      } // for
+    } // for
+    qreturn_if(count == 0, std::unexpected("Connection closed"));
+    if ( m_count_size < sizeof(m_size) )
+    {
+      m_count_size += count;
+      qcontinue_if(m_count_size < sizeof(m_size));
+      qreturn_if(m_size > SIZE_FRAME_MAX, std::unexpected("Frame is too large"));
+      m_payload.resize(m_size);
+    } // if
+    else
+    {
+      m_count_payload += count;
+    } // else
+  } // while
+  return true;
+} // fn: Receiver::read() }}}
+
+// fn: Receiver::take() {{{
+inline std::pair<std::string, std::vector<int>> Receiver::take()
+{
+  return { std::exchange(m_payload, {}), std::exchange(m_fds, {}) };
+} // fn: Receiver::take() }}}
+
+} // namespace ns_socket
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -34,7 +34,7 @@ class SquashFs
     SquashFs& operator=(SquashFs const&) = delete;
     SquashFs& operator=(SquashFs&&) = delete;
 
-    SquashFs(fs::path const& path_file_image, fs::path const& path_dir_mount, uint64_t offset)
+    SquashFs(fs::path const& path_file_image, fs::path const& path_dir_mount, uint64_t offset, pid_t pid_to_die_for)
       : m_path_dir_mountpoint(path_dir_mount)
     {
       // Check if image exists and is a regular file
@@ -58,9 +58,9 @@ class SquashFs
        (void) m_subprocess->with_piped_outputs()
         .with_args("-f", "-o", "offset={}"_fmt(offset))
         .with_args(path_file_image, path_dir_mount)
+        .with_die_on_pid(pid_to_die_for)
         .spawn();
-      // Wait for mount
-      ns_fuse::wait_fuse(path_dir_mount);
+      // The mount is ready after ns_fuse::wait_fuse, so several layers can start at once
     } // SquashFs
     
     ~SquashFs()
@@ -84,6 +84,22 @@ class SquashFs
     }
 }; // class SquashFs }}}
 
+// is_squashfs() {{{
+inline bool is_squashfs(fs::path const& path_file_squashfs, uint64_t offset = 0)
+{
+  // Open file
+  std::ifstream file_squashfs(path_file_squashfs, std::ios::binary | std::ios::in);
+  ereturn_if(not file_squashfs.is_open(), "Could not open file '{}'"_fmt(path_file_squashfs), false);
+  // Adjust offset
+  file_squashfs.seekg(offset);
+  ereturn_if(not file_squashfs, "Failed to seek offset '{}' in file '{}'"_fmt(offset, path_file_squashfs), false);
+  // Read initial 'hsqs' identifier
+  std::array<char,4> header;
+  qreturn_if(not file_squashfs.read(header.data(), header.size()), false);
+  // Check for match
+  return std::ranges::equal(header, std::string_view("hsqs"));
+} // is_squashfs() }}}
+
 } // namespace ns_squashfs
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
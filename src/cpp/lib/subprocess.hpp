@@ -14,9 +14,19 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/prctl.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/sysmacros.h>
+#include <map>
+#include <fstream>
+#include <mutex>
 #include <ranges>
 
 #include "log.hpp"
+#include "reactor.hpp"
+#include "environment.hpp"
 #include "../macro.hpp"
 #include "../std/vector.hpp"
 
@@ -28,50 +38,160 @@ namespace
 
 namespace fs = std::filesystem;
 
+// Stack of the cloned child, it only runs until execve
+constexpr size_t const SIZE_STACK_SPAWN = 65536;
+
+// struct SpawnArgs {{{
+// Everything the child needs is computed before clone, the child shares the parent memory
+// and must not allocate or take locks
+struct SpawnArgs
+{
+  char const* path;
+  char* const* argv;
+  char* const* envp;
+  // Write ends of the output pipes, -1 to inherit
+  int fd_stdout;
+  int fd_stderr;
+  // Process to die with, -1 for none
+  pid_t pid_die_on;
+  // Close-on-exec file descriptors to keep open across execve
+  int const* fds_inherit;
+  size_t count_fds_inherit;
+  sigset_t const* sigset_parent;
+  // Set by the child when it fails before or on execve
+  int error;
+  char const* error_step;
+}; // struct SpawnArgs }}}
+
+// fn: spawn_child() {{{
+inline int spawn_child(void* ptr_args)
+{
+  SpawnArgs* args = static_cast<SpawnArgs*>(ptr_args);
+  auto f_fail = [&](char const* step)
+  {
+    args->error = errno;
+    args->error_step = step;
+    _exit(127);
+  };
+  // Reset handlers installed by the parent, they must not run in the child
+  struct sigaction action_default{};
+  action_default.sa_handler = SIG_DFL;
+  for (int signal = 1; signal < NSIG; ++signal)
+  {
+    struct sigaction action_current;
+    qcontinue_if(sigaction(signal, nullptr, &action_current) < 0);
+    qcontinue_if(action_current.sa_handler == SIG_DFL or action_current.sa_handler == SIG_IGN);
+    sigaction(signal, &action_default, nullptr);
+  } // for
+  // Restore the signal mask of the parent
+  if ( sigprocmask(SIG_SETMASK, args->sigset_parent, nullptr) < 0 ) { f_fail("sigprocmask"); }
+  // Replace the standard outputs with the pipes, dup2 clears close-on-exec
+  if ( args->fd_stdout >= 0 and dup2(args->fd_stdout, STDOUT_FILENO) < 0 ) { f_fail("dup2(stdout)"); }
+  if ( args->fd_stderr >= 0 and dup2(args->fd_stderr, STDERR_FILENO) < 0 ) { f_fail("dup2(stderr)"); }
+  // Only the child clears close-on-exec, so the fds do not leak into concurrent spawns
+  for (size_t i = 0; i < args->count_fds_inherit; ++i)
+  {
+    if ( fcntl(args->fds_inherit[i], F_SETFD, 0) < 0 ) { f_fail("fcntl"); }
+  } // for
+  // Die with the given process, abort if it is already gone
+  if ( args->pid_die_on >= 0 )
+  {
+    if ( prctl(PR_SET_PDEATHSIG, SIGKILL) < 0 ) { f_fail("prctl"); }
+    if ( ::kill(args->pid_die_on, 0) < 0 ) { f_fail("kill"); }
+  } // if
+  execve(args->path, args->argv, args->envp);
+  f_fail("execve");
+  return 127;
+} // fn: spawn_child() }}}
+
+// fn: search_path_cache() {{{
+// Process-wide cache of search_path, keyed by (PATH, name)
+inline auto& search_path_cache()
+{
+  static struct
+  {
+    std::mutex mutex;
+    std::map<std::pair<std::string,std::string>,std::string> entries;
+  } cache;
+  return cache;
+} // fn: search_path_cache() }}}
+
 } // namespace
 
-// search_path() {{{
-inline std::optional<std::string> search_path(std::string const& s)
+// search_path_register() {{{
+// Resolves the files of 'path_dir', the first directory of 'str_path', to their absolute paths,
+// which is what a search would find first
+inline void search_path_register(fs::path const& path_dir, std::string const& str_path)
 {
-  const char* cstr_path = getenv("PATH");
-  ereturn_if(cstr_path == nullptr, "PATH: Could not read PATH", std::nullopt);
+  std::lock_guard lock(search_path_cache().mutex);
+  std::error_code ec;
+  for (auto&& entry : fs::directory_iterator(path_dir, ec))
+  {
+    qcontinue_if(entry.is_directory(ec));
+    search_path_cache().entries[{str_path, entry.path().filename().string()}] = entry.path().string();
+  } // for
+} // search_path_register() }}}
 
-  std::string str_path{cstr_path};
-  auto view = str_path | std::views::split(':');
-  auto it = std::find_if(view.begin(), view.end(), [&](auto&& e)
+// search_path() {{{
+// Resolves 's' in the directories of 'str_path'. Found paths are cached by (PATH, name) and
+// trusted while they exist, a file later created earlier in PATH does not shadow them
+inline std::optional<std::string> search_path(std::string const& s, std::string const& str_path)
+{
+  auto f_exists = [](std::string const& path_file)
   {
-    ns_log::debug()("PATH: Check for {}", fs::path(e.begin(), e.end()) / s);
-    return fs::exists(fs::path(e.begin(), e.end()) / s);
-  });
+    struct stat stat_file;
+    return stat(path_file.c_str(), &stat_file) == 0 and not S_ISDIR(stat_file.st_mode);
+  };
+
+  std::lock_guard lock(search_path_cache().mutex);
+  auto& cache = search_path_cache().entries;
+  auto key = std::make_pair(str_path, s);
 
-  if (it != view.end())
+  // Check cache
+  if ( auto it = cache.find(key); it != cache.end() )
   {
-    auto result = fs::path((*it).begin(), (*it).end()) / s;
-    ns_log::debug()("PATH: Found '{}'", result);
-    return result;
+    qreturn_if(f_exists(it->second), it->second);
+    cache.erase(it);
   } // if
 
+  // Search PATH
+  for (auto&& range : str_path | std::views::split(':'))
+  {
+    std::string_view path_dir(range.begin(), range.end());
+    qcontinue_if(path_dir.empty());
+    std::string path_file = (fs::path(path_dir) / s).string();
+    qcontinue_if(not f_exists(path_file));
+    ns_log::debug()("PATH: Found '{}'", path_file);
+    return cache.emplace(key, std::move(path_file)).first->second;
+  } // for
+
   ns_log::debug()("PATH: Could not find '{}'", s);
   return std::nullopt;
 } // search_path()}}}
 
+// search_path() {{{
+inline std::optional<std::string> search_path(std::string const& s)
+{
+  const char* cstr_path = getenv("PATH");
+  ereturn_if(cstr_path == nullptr, "PATH: Could not read PATH", std::nullopt);
+  return search_path(s, std::string{cstr_path});
+} // search_path()}}}
+
 // class Subprocess {{{
 class Subprocess
 {
   private:
     std::string m_program;
     std::vector<std::string> m_args;
-    std::vector<std::string> m_env;
+    ns_environment::Environment m_env;
     std::optional<pid_t> m_opt_pid;
-    std::vector<pid_t> m_vec_pids_pipe;
     std::optional<std::function<void(std::string)>> m_fstdout;
     std::optional<std::function<void(std::string)>> m_fstderr;
     bool m_with_piped_outputs;
     std::optional<pid_t> m_die_on_pid;
+    std::vector<int> m_fds_inherit;
 
     [[nodiscard]] Subprocess& with_pipes_parent(int pipestdout[2], int pipestderr[2]);
-    void with_pipes_child(int pipestdout[2], int pipestderr[2]);
-    void die_on_pid(pid_t pid);
   public:
     template<ns_concept::StringRepresentable T>
     [[nodiscard]] Subprocess(T&& t);
@@ -112,6 +232,8 @@ class Subprocess
 
     [[nodiscard]] Subprocess& with_die_on_pid(pid_t pid);
 
+    [[nodiscard]] Subprocess& with_inherit_fd(int fd);
+
     [[nodiscard]] Subprocess& with_piped_outputs();
 
     template<typename F>
@@ -129,15 +251,11 @@ class Subprocess
 template<ns_concept::StringRepresentable T>
 Subprocess::Subprocess(T&& t)
   : m_program(ns_string::to_string(t))
+  , m_env(environ)
   , m_with_piped_outputs(false)
 {
   // argv0 is program name
   m_args.push_back(m_program);
-  // Copy environment
-  for(char** i = environ; *i != nullptr; ++i)
-  {
-    m_env.push_back(*i);
-  } // for
 } // Subprocess }}}
 
 // Subprocess::~Subprocess {{{
@@ -157,8 +275,7 @@ inline Subprocess& Subprocess::env_clear()
 template<ns_concept::StringRepresentable K, ns_concept::StringRepresentable V>
 Subprocess& Subprocess::with_var(K&& k, V&& v)
 {
-  rm_var(k);
-  m_env.push_back("{}={}"_fmt(k,v));
+  m_env.set(ns_string::to_string(k), ns_string::to_string(v));
   return *this;
 } // with_var() }}}
 
@@ -166,21 +283,11 @@ Subprocess& Subprocess::with_var(K&& k, V&& v)
 template<ns_concept::StringRepresentable K>
 Subprocess& Subprocess::rm_var(K&& k)
 {
-  // Find variable
-  auto it = std::ranges::find_if(m_env, [&](std::string const& e)
-  {
-    auto vec = ns_vector::from_string(e, '=');
-    qreturn_if(vec.empty(), false);
-    return vec.front() == k;
-  });
-
-  // Erase if found
-  if ( it != std::ranges::end(m_env) )
+  std::string key = ns_string::to_string(k);
+  if ( m_env.erase(key) )
   {
-    ns_log::debug()("Erased var entry: {}", *it);
-    m_env.erase(it);
+    ns_log::debug()("Erased var entry: {}", key);
   } // if
-
   return *this;
 } // rm_var() }}}
 
@@ -243,32 +350,22 @@ Subprocess& Subprocess::with_env(Arg&& arg, Args&&... args)
 template<typename T>
 Subprocess& Subprocess::with_env(T&& t)
 {
-  auto f_erase_existing = [this](auto&& entries)
+  auto f_set = [this](std::string_view entry)
   {
-    for (auto&& entry : entries)
-    {
-      auto parts = ns_vector::from_string(entry, '=');
-      econtinue_if(parts.size() < 2, "Entry '{}' is not valid"_fmt(entry));
-      std::string key = parts.front();
-      (void) this->rm_var(key);
-    } // for
+    elog_if(not m_env.set(entry), "Entry '{}' is not valid"_fmt(entry));
   };
 
   if constexpr ( ns_concept::SameAs<T, std::string> )
   {
-    f_erase_existing(std::vector<std::string>{t});
-    this->m_env.push_back(std::forward<T>(t));
+    f_set(t);
   } // if
   else if constexpr ( ns_concept::IterableConst<T> )
   {
-    f_erase_existing(t);
-    std::ranges::copy(t, std::back_inserter(m_env));
+    std::ranges::for_each(t, f_set);
   } // else if
   else if constexpr ( ns_concept::StringRepresentable<T> )
   {
-    auto entry = ns_string::to_string(std::forward<T>(t));
-    f_erase_existing(std::vector<std::string>{entry});
-    this->m_env.push_back(entry);
+    f_set(ns_string::to_string(std::forward<T>(t)));
   } // else if
   else
   {
@@ -285,6 +382,14 @@ inline Subprocess& Subprocess::with_die_on_pid(pid_t pid)
   return *this;
 } // with_die_on_pid }}}
 
+// with_inherit_fd() {{{
+// Keeps a close-on-exec file descriptor open in the child
+inline Subprocess& Subprocess::with_inherit_fd(int fd)
+{
+  m_fds_inherit.push_back(fd);
+  return *this;
+} // with_inherit_fd }}}
+
 // with_piped_outputs() {{{
 inline Subprocess& Subprocess::with_piped_outputs()
 {
@@ -293,6 +398,7 @@ inline Subprocess& Subprocess::with_piped_outputs()
 } // with_piped_outputs() }}}
 
 // with_pipes_parent() {{{
+// Hands the read ends to the reactor thread, handlers may outlive this object
 inline Subprocess& Subprocess::with_pipes_parent(int pipestdout[2], int pipestderr[2])
 {
   // Close write end
@@ -301,38 +407,10 @@ inline Subprocess& Subprocess::with_pipes_parent(int pipestdout[2], int pipestde
 
   auto f_read_pipe = [this](int id_pipe, std::string_view prefix, auto&& f)
   {
-    // Fork
-    pid_t ppid = getpid();
-    pid_t pid = fork();
-    ereturn_if(pid < 0, "Could not fork '{}'"_fmt(strerror(errno)));
-    // Parent ends here
-    if (pid > 0 )
-    {
-      m_vec_pids_pipe.push_back(pid);
-      return;
-    } // if
-    // Die with parent
-    eabort_if(prctl(PR_SET_PDEATHSIG, SIGKILL) < 0, strerror(errno));
-    eabort_if(::kill(ppid, 0) < 0, "Parent died, prctl will not have effect: {}"_fmt(strerror(errno)));
     // Check if 'f' is defined
-    if ( not f ) { f = [&](auto&& e) { ns_log::debug()("{}({}): {}", prefix, m_program, e); }; }
+    if ( not f ) { f = [prefix = std::string{prefix}, program = m_program](auto&& e) { ns_log::debug()("{}({}): {}", prefix, program, e); }; }
     // Apply f to incoming data from pipe
-    char buffer[1024];
-    ssize_t count;
-    while ((count = read(id_pipe, buffer, sizeof(buffer))) != 0)
-    {
-      // Failed to read
-      ebreak_if(count == -1, "broke parent read loop: {}"_fmt(strerror(errno)));
-      // Split newlines and print each line with prefix
-      std::ranges::for_each(std::string(buffer, count)
-          | std::views::split('\n')
-          | std::views::filter([&](auto&& e){ return not e.empty(); })
-        , [&](auto&& e){ (*f)(std::string{e.begin(), e.end()});
-      });
-    } // while
-    close(id_pipe);
-    // Exit normally
-    exit(0);
+    ns_reactor::reactor().add(id_pipe, *f);
   };
   // Create pipes from fifo to ostream
   f_read_pipe(pipestdout[0], "stdout", this->m_fstdout);
@@ -341,37 +419,6 @@ inline Subprocess& Subprocess::with_pipes_parent(int pipestdout[2], int pipestde
   return *this;
 } // with_pipes_parent() }}}
 
-// with_pipes_child() {{{
-inline void Subprocess::with_pipes_child(int pipestdout[2], int pipestderr[2])
-{
-  // Close read end
-  ereturn_if(close(pipestdout[0]) == -1, "pipestdout[0]: {}"_fmt(strerror(errno)));
-  ereturn_if(close(pipestderr[0]) == -1, "pipestderr[0]: {}"_fmt(strerror(errno)));
-
-  // Make the opened pipe the replace stdout
-  ereturn_if(dup2(pipestdout[1], STDOUT_FILENO) == -1, "dup2(pipestdout[1]): {}"_fmt(strerror(errno)));
-  ereturn_if(dup2(pipestderr[1], STDERR_FILENO) == -1, "dup2(pipestderr[1]): {}"_fmt(strerror(errno)));
-
-  // Close original write end after duplication
-  ereturn_if(close(pipestdout[1]) == -1, "pipestdout[1]: {}"_fmt(strerror(errno)));
-  ereturn_if(close(pipestderr[1]) == -1, "pipestderr[1]: {}"_fmt(strerror(errno)));
-} // with_pipes_child() }}}
-
-// die_on_pid() {{{
-inline void Subprocess::die_on_pid(pid_t pid)
-{
-  // Set death signal when pid dies
-  ereturn_if(prctl(PR_SET_PDEATHSIG, SIGKILL) < 0, strerror(errno));
-  // Abort if pid is not running
-  if (::kill(pid, 0) < 0)
-  {
-    ns_log::error()("Parent died, prctl will not have effect: {}", strerror(errno));
-    std::abort();
-  } // if
-  // Log pid and current pid
-  ns_log::debug()("{} dies with {}", getpid(), pid);
-} // die_on_pid() }}}
-
 // with_stdout_handle() {{{
 template<typename F>
 Subprocess& Subprocess::with_stdout_handle(F&& f)
@@ -398,12 +445,6 @@ inline std::optional<int> Subprocess::wait()
   int status;
   waitpid(*m_opt_pid, &status, 0);
 
-  // Send SIGTERM for reader forks
-  std::ranges::for_each(m_vec_pids_pipe, [](pid_t pid){ ::kill(pid, SIGTERM); });
-
-  // Wait for forks
-  std::ranges::for_each(m_vec_pids_pipe, [](pid_t pid){ waitpid(pid, nullptr, 0); });
-
   return (WIFEXITED(status))? std::make_optional(WEXITSTATUS(status)) : std::nullopt;
 } // wait() }}}
 
@@ -413,13 +454,6 @@ inline Subprocess& Subprocess::spawn()
   // Log
   ns_log::debug()("Spawn command: {}", m_args);
 
-  int pipestdout[2];
-  int pipestderr[2];
-
-  // Create pipe
-  ereturn_if(pipe(pipestdout), strerror(errno), *this);
-  ereturn_if(pipe(pipestderr), strerror(errno), *this);
-
   // Ignore on empty vec_argv
   if ( m_args.empty() )
   {
@@ -427,95 +461,137 @@ inline Subprocess& Subprocess::spawn()
     return *this;
   } // if
 
-  // Create child
-  m_opt_pid = fork();
-
-  // Failed to fork
-  ereturn_if(*m_opt_pid == -1, "Failed to fork", *this);
-
-  // Setup pipe on child and parent
-  // On parent, return exit code of child
-  if ( *m_opt_pid > 0 )
-  {
-    if ( m_with_piped_outputs )
-    {
-      return with_pipes_parent(pipestdout, pipestderr);
-    } // if
-    else
-    {
-      return *this;
-    } // else
-  } // if
-
-  // On child, just setup the pipe
-  if ( m_with_piped_outputs && *m_opt_pid == 0)
-  {
-    // this is non-blocking, setup pipes and perform execve afterwards
-    with_pipes_child(pipestdout, pipestderr);
-  } // else
+  int pipestdout[2];
+  int pipestderr[2];
 
-  // Check if should die with pid
-  if ( m_die_on_pid )
+  // Create pipes, close-on-exec so they do not leak into other children
+  if ( m_with_piped_outputs )
   {
-    die_on_pid(*m_die_on_pid);
+    ereturn_if(pipe2(pipestdout, O_CLOEXEC), strerror(errno), *this);
+    ereturn_if(pipe2(pipestderr, O_CLOEXEC), strerror(errno), *this);
   } // if
 
-  // Create arguments for execve
-  auto argv_custom = std::make_unique<const char*[]>(m_args.size() + 1);
-
-  // Copy arguments
-  std::ranges::transform(m_args, argv_custom.get(), [](auto&& e) { return e.c_str(); });
+  // Create arguments for execve before cloning, the environment is already null-terminated
+  std::vector<char*> vec_argv;
+  std::ranges::transform(m_args, std::back_inserter(vec_argv), [](auto&& e) { return const_cast<char*>(e.c_str()); });
+  vec_argv.push_back(nullptr);
 
-  // Set last entry to nullptr
-  argv_custom[m_args.size()] = nullptr;
+  // Block signals so no handler runs on the child while it shares the parent memory
+  sigset_t sigset_all, sigset_parent;
+  sigfillset(&sigset_all);
+  pthread_sigmask(SIG_SETMASK, &sigset_all, &sigset_parent);
 
-  // Set environment variables
-  std::ranges::for_each(m_env, [](auto&& e)
+  SpawnArgs args
   {
-    auto entry = ns_vector::from_string(e, '=');
-    ereturn_if(entry.size() < 2, "Invalid environment variable '{}'"_fmt(e));
-    setenv(entry.front().c_str()
-      , ns_string::from_container(std::next(entry.begin()), entry.end()).c_str()
-      , 1
-    );
-  });
-
-  // Create environment for execve
-  auto envp_custom = std::make_unique<const char*[]>(m_env.size() + 1);
+      .path = m_program.c_str()
+    , .argv = vec_argv.data()
+    , .envp = m_env.envp()
+    , .fd_stdout = (m_with_piped_outputs)? pipestdout[1] : -1
+    , .fd_stderr = (m_with_piped_outputs)? pipestderr[1] : -1
+    , .pid_die_on = m_die_on_pid.value_or(-1)
+    , .fds_inherit = m_fds_inherit.data()
+    , .count_fds_inherit = m_fds_inherit.size()
+    , .sigset_parent = &sigset_parent
+    , .error = 0
+    , .error_step = nullptr
+  };
 
-  // Copy variables
-  std::transform(m_env.begin(), m_env.end(), envp_custom.get(), [](auto&& e) { return e.c_str(); });
+  // Create child, it shares the memory of the parent which is suspended until execve. This avoids
+  // copying the page tables of the parent as fork does
+  std::vector<char> stack(SIZE_STACK_SPAWN);
+  pid_t pid = clone(spawn_child, stack.data() + stack.size(), CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  int error_clone = errno;
+  pthread_sigmask(SIG_SETMASK, &sigset_parent, nullptr);
 
-  // Set last entry to nullptr
-  envp_custom[m_env.size()] = nullptr;
+  // Failed to clone
+  if ( pid < 0 )
+  {
+    ns_log::error()("Failed to clone: {}", strerror(error_clone));
+    if ( m_with_piped_outputs ) { for (int fd : {pipestdout[0], pipestdout[1], pipestderr[0], pipestderr[1]}) { close(fd); } }
+    return *this;
+  } // if
+  m_opt_pid = pid;
 
-  // Perform execve
-  execve(m_program.c_str(), (char**) argv_custom.get(), (char**) envp_custom.get());
+  // The child exits with 127 on failure, it is reaped on wait()
+  elog_if(args.error != 0, "{}() failed for '{}': {}"_fmt(args.error_step, m_program, strerror(args.error)));
 
-  // Log error
-  ns_log::error()("execve() failed: ", strerror(errno));
+  // Read outputs
+  if ( m_with_piped_outputs )
+  {
+    return with_pipes_parent(pipestdout, pipestderr);
+  } // if
 
-  // Child should stop here
-  std::abort();
+  return *this;
 } // spawn() }}}
 
+// is_busy_file() {{{
+// Checks if any other process has the file open, mapped or as its executable
+inline bool is_busy_file(fs::path const& path_file_target)
+{
+  std::string str_pid_self = std::to_string(getpid());
+  struct stat stat_target;
+  qreturn_if(stat(path_file_target.c_str(), &stat_target) < 0, false);
+  auto f_is_target = [&](fs::path const& path_file)
+  {
+    struct stat stat_file;
+    return stat(path_file.c_str(), &stat_file) == 0
+      and stat_file.st_dev == stat_target.st_dev
+      and stat_file.st_ino == stat_target.st_ino;
+  };
+  std::error_code ec;
+  for (auto&& entry_proc : fs::directory_iterator("/proc", ec))
+  {
+    std::string str_pid = entry_proc.path().filename().string();
+    qcontinue_if(not std::ranges::all_of(str_pid, ::isdigit));
+    qcontinue_if(str_pid == str_pid_self);
+    // Executable
+    qreturn_if(f_is_target(entry_proc.path() / "exe"), true);
+    // Open files, processes of other users are not readable
+    std::error_code ec_fd;
+    for (auto&& entry_fd : fs::directory_iterator(entry_proc.path() / "fd", ec_fd))
+    {
+      qreturn_if(f_is_target(entry_fd.path()), true);
+    } // for
+    // Memory mappings, formatted as 'address perms offset major:minor inode path'
+    std::ifstream file_maps(entry_proc.path() / "maps");
+    for (std::string line; std::getline(file_maps, line);)
+    {
+      unsigned int dev_major, dev_minor;
+      unsigned long inode;
+      qcontinue_if(sscanf(line.c_str(), "%*s %*s %*s %x:%x %lu", &dev_major, &dev_minor, &inode) != 3);
+      qreturn_if(inode == stat_target.st_ino
+        and dev_major == major(stat_target.st_dev)
+        and dev_minor == minor(stat_target.st_dev), true);
+    } // for
+  } // for
+  return false;
+} // is_busy_file() }}}
+
 // wait_busy_file() {{{
+// Blocks until no process uses the file, wakes up on each close of the file
 inline std::optional<std::string> wait_busy_file(fs::path const& path_file_target)
 {
-  auto path_file_lsof = search_path("lsof");
-  qreturn_if(not path_file_lsof, std::optional("Could not locate lsof binary"));
+  // Watch before checking, so a close between the check and the read is not lost
+  int fd_inotify = inotify_init1(IN_CLOEXEC);
+  qreturn_if(fd_inotify < 0, "Could not create inotify instance: {}"_fmt(strerror(errno)));
+  if ( inotify_add_watch(fd_inotify, path_file_target.c_str(), IN_CLOSE | IN_DELETE_SELF) < 0 )
+  {
+    close(fd_inotify);
+    return "Could not watch '{}': {}"_fmt(path_file_target, strerror(errno));
+  } // if
 
-  while(true)
+  while ( is_busy_file(path_file_target) )
   {
-    auto ret = Subprocess(*path_file_lsof)
-      .with_piped_outputs()
-      .with_args(path_file_target)
-      .spawn()
-      .wait();
-    ebreak_if(not ret, "Failed to query status for busy file");
-    dbreak_if(*ret != 0, "break, file is not busy");
+    alignas(inotify_event) char buffer[4096];
+    ssize_t count = read(fd_inotify, buffer, sizeof(buffer));
+    qcontinue_if(count < 0 and errno == EINTR);
+    ebreak_if(count <= 0, "Failed to read inotify events: {}"_fmt(strerror(errno)));
+    // Stop if the file is gone
+    auto* event = reinterpret_cast<inotify_event*>(buffer);
+    dbreak_if(event->mask & (IN_DELETE_SELF | IN_IGNORED), "break, file was removed");
   } // while
 
+  close(fd_inotify);
   return std::nullopt;
 } // wait_busy_file()}}}
 
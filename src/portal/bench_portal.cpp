@@ -0,0 +1,241 @@
+///
+// @author      : Ruan E. Formigoni (ruanformigoni@gmail.com)
+// @file        : bench_portal
+///
+
+// Usage: bench_portal <dir-binaries> [callers] [calls-per-caller] [size-stream-mib] [max-p50-ms]
+// Starts fim_portal_daemon on a temporary socket and drives fim_portal from <dir-binaries>.
+// Reports the round-trip latency of 'true', the bytes/s of 'cat' on a temporary file of
+// <size-stream-mib> MiB (default 1024) and the peak number of processes below the daemon.
+// With <max-p50-ms> it fails if a call failed or the median latency exceeds it, as a regression
+// test of the portal handshake
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <optional>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../cpp/lib/log.hpp"
+#include "../cpp/lib/bench.hpp"
+#include "../cpp/macro.hpp"
+#include "../cpp/common.hpp"
+
+namespace fs = std::filesystem;
+
+// spawn() {{{
+// Runs argv with stdout redirected to fd_stdout, -1 keeps the current one
+pid_t spawn(std::vector<std::string> const& vec_argv, int fd_stdout = -1)
+{
+  std::vector<char*> vec_argv_custom;
+  std::ranges::transform(vec_argv, std::back_inserter(vec_argv_custom), [](auto&& e){ return const_cast<char*>(e.c_str()); });
+  vec_argv_custom.push_back(nullptr);
+  pid_t pid = fork();
+  qreturn_if(pid != 0, pid);
+  if ( fd_stdout >= 0 and dup2(fd_stdout, STDOUT_FILENO) < 0 ) { _exit(127); }
+  execv(vec_argv_custom[0], vec_argv_custom.data());
+  _exit(127);
+} // spawn() }}}
+
+// wait_exit() {{{
+int wait_exit(pid_t pid)
+{
+  int status;
+  while ( waitpid(pid, &status, 0) < 0 )
+  {
+    qreturn_if(errno != EINTR, -1);
+  } // while
+  return WIFEXITED(status)? WEXITSTATUS(status) : -1;
+} // wait_exit() }}}
+
+// count_children() {{{
+// Number of processes whose parent is pid
+uint64_t count_children(pid_t pid)
+{
+  uint64_t count = 0;
+  std::error_code ec;
+  for (auto&& entry : fs::directory_iterator("/proc", ec))
+  {
+    std::ifstream file_stat(entry.path() / "stat");
+    qcontinue_if(not file_stat.is_open());
+    std::string line;
+    std::getline(file_stat, line);
+    // The command name may contain spaces, the parent pid follows the state after ')'
+    size_t pos = line.rfind(')');
+    qcontinue_if(pos == std::string::npos);
+    char state;
+    pid_t ppid;
+    qcontinue_if(sscanf(line.c_str() + pos + 1, " %c %d", &state, &ppid) != 2);
+    count += (ppid == pid);
+  } // for
+  return count;
+} // count_children() }}}
+
+// bench_latency() {{{
+// Runs 'true' from each caller and returns the round trip of every call in milliseconds
+std::vector<double> bench_latency(fs::path const& path_file_guest, uint64_t callers, uint64_t calls)
+{
+  std::vector<double> vec_latencies;
+  std::mutex mutex_latencies;
+  std::vector<std::jthread> vec_threads;
+  for (uint64_t i = 0; i < callers; ++i)
+  {
+    vec_threads.emplace_back([&]
+    {
+      std::vector<double> vec_local;
+      for (uint64_t j = 0; j < calls; ++j)
+      {
+        auto time_start = ns_bench::Clock::now();
+        int code = wait_exit(spawn({path_file_guest, "true"}));
+        econtinue_if(code != 0, "Call exited with code '{}'"_fmt(code));
+        vec_local.push_back(ns_bench::since<ns_bench::Milliseconds>(time_start));
+      } // for
+      std::lock_guard lock(mutex_latencies);
+      vec_latencies.insert(vec_latencies.end(), vec_local.begin(), vec_local.end());
+    });
+  } // for
+  vec_threads.clear();
+  return vec_latencies;
+} // bench_latency() }}}
+
+// create_stream() {{{
+// Writes a file of size_mib MiB to stream, with data so reads are not served from holes
+bool create_stream(fs::path const& path_file, uint64_t size_mib)
+{
+  int fd = open(path_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  ereturn_if(fd < 0, "Could not create '{}': {}"_fmt(path_file, strerror(errno)), false);
+  std::vector<char> buffer(1 << 20);
+  for (size_t i = 0; i < buffer.size(); ++i) { buffer[i] = static_cast<char>('a' + i % 26); }
+  for (uint64_t i = 0; i < size_mib; ++i)
+  {
+    for (size_t offset = 0; offset < buffer.size();)
+    {
+      ssize_t count = write(fd, buffer.data() + offset, buffer.size() - offset);
+      qcontinue_if(count < 0 and errno == EINTR);
+      if ( count <= 0 )
+      {
+        ns_log::error()("Could not write '{}': {}", path_file, strerror(errno));
+        close(fd);
+        return false;
+      } // if
+      offset += count;
+    } // for
+  } // for
+  close(fd);
+  return true;
+} // create_stream() }}}
+
+// bench_stream() {{{
+// Streams path_file with 'cat' through the portal, returns the bytes/s
+double bench_stream(fs::path const& path_file_guest, fs::path const& path_file)
+{
+  int fds[2];
+  ereturn_if(pipe2(fds, O_CLOEXEC) < 0, "Could not create pipe: {}"_fmt(strerror(errno)), 0);
+  auto time_start = ns_bench::Clock::now();
+  pid_t pid = spawn({path_file_guest, "cat", path_file}, fds[1]);
+  close(fds[1]);
+  uint64_t bytes = 0;
+  std::vector<char> buffer(1 << 16);
+  for (ssize_t count; (count = read(fds[0], buffer.data(), buffer.size())) != 0;)
+  {
+    qcontinue_if(count < 0 and errno == EINTR);
+    qbreak_if(count < 0);
+    bytes += count;
+  } // for
+  close(fds[0]);
+  wait_exit(pid);
+  return ns_bench::rate(bytes, ns_bench::since(time_start));
+} // bench_stream() }}}
+
+// main() {{{
+int main(int argc, char** argv)
+{
+  ns_log::set_level(ns_log::Level::ERROR);
+  ereturn_if(argc < 2 or argc > 6, "Usage: bench_portal <dir-binaries> [callers] [calls-per-caller] [size-stream-mib] [max-p50-ms]", EXIT_FAILURE);
+  fs::path path_dir_binaries = fs::absolute(argv[1]);
+  uint64_t callers = (argc > 2)? std::stoull(argv[2]) : 16;
+  uint64_t calls = (argc > 3)? std::stoull(argv[3]) : 100;
+  uint64_t size_stream = (argc > 4)? std::stoull(argv[4]) : 1024;
+  std::optional<double> opt_max_p50 = (argc > 5)? std::make_optional(std::stod(argv[5])) : std::nullopt;
+  fs::path path_file_guest = path_dir_binaries / "fim_portal";
+  fs::path path_file_daemon = path_dir_binaries / "fim_portal_daemon";
+
+  // Temporary directory for the socket and the daemon log
+  std::string str_dir_temp = (fs::temp_directory_path() / "fim-bench-portal-XXXXXX").string();
+  ereturn_if(mkdtemp(str_dir_temp.data()) == nullptr, "Could not create temporary directory", EXIT_FAILURE);
+  fs::path path_dir_temp = str_dir_temp;
+  fs::path path_file_socket = path_dir_temp / "portal.sock";
+  setenv("FIM_DIR_MOUNT", (path_dir_temp / "mount").c_str(), 1);
+  setenv("FIM_PORTAL_SOCKET", path_file_socket.c_str(), 1);
+
+  // File to stream through the portal
+  fs::path path_file_stream = path_dir_temp / "stream";
+  if ( not create_stream(path_file_stream, size_stream) )
+  {
+    std::error_code ec;
+    fs::remove_all(path_dir_temp, ec);
+    return EXIT_FAILURE;
+  } // if
+
+  // Start daemon and wait for its socket
+  pid_t pid_daemon = spawn({path_file_daemon, path_file_socket});
+  for (int i = 0; i < 500 and not fs::exists(path_file_socket); ++i)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  } // for
+
+  // Sample the processes below the daemon while the callers run
+  std::atomic_bool is_sampling = true;
+  std::atomic<uint64_t> count_peak = 0;
+  std::jthread thread_sampler([&]
+  {
+    while ( is_sampling )
+    {
+      count_peak = std::max(count_peak.load(), count_children(pid_daemon));
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    } // while
+  });
+
+  auto time_start = ns_bench::Clock::now();
+  std::vector<double> vec_latencies = bench_latency(path_file_guest, callers, calls);
+  double seconds = ns_bench::since(time_start);
+  double bytes_per_second = bench_stream(path_file_guest, path_file_stream);
+  is_sampling = false;
+  thread_sampler.join();
+
+  println("callers: {}, calls: {}/{}", callers, vec_latencies.size(), callers * calls);
+  println("latency p50: {} ms, p99: {} ms"
+    , ns_bench::fixed(ns_bench::percentile(vec_latencies, 0.50), 3)
+    , ns_bench::fixed(ns_bench::percentile(vec_latencies, 0.99), 3)
+  );
+  println("calls/s: {}", ns_bench::fixed(ns_bench::rate(vec_latencies.size(), seconds), 1));
+  println("stream {} MiB: {} MiB/s", size_stream, ns_bench::fixed(bytes_per_second / (1 << 20), 1));
+  println("peak processes below daemon: {}", count_peak.load());
+
+  // Stop daemon
+  kill(pid_daemon, SIGTERM);
+  wait_exit(pid_daemon);
+  std::error_code ec;
+  fs::remove_all(path_dir_temp, ec);
+
+  // Regression check
+  qreturn_if(not opt_max_p50, EXIT_SUCCESS);
+  ereturn_if(vec_latencies.size() != callers * calls
+    , "'{}' of '{}' calls failed"_fmt(callers * calls - vec_latencies.size(), callers * calls)
+    , EXIT_FAILURE
+  );
+  ereturn_if(ns_bench::percentile(vec_latencies, 0.50) > *opt_max_p50
+    , "Latency p50 of '{}' ms is above '{}' ms"_fmt(ns_bench::fixed(ns_bench::percentile(vec_latencies, 0.50), 3), argv[5])
+    , EXIT_FAILURE
+  );
+  return EXIT_SUCCESS;
+} // main() }}}
+
+/* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
@@ -3,185 +3,168 @@
 // @file        : portal_guest
 ///
 
-#include <csignal>
-#include <fcntl.h>
-#include <filesystem>
-#include <sys/stat.h>
+#include <array>
+#include <chrono>
 #include <thread>
+#include <filesystem>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "../cpp/macro.hpp"
 #include "../cpp/lib/env.hpp"
 #include "../cpp/lib/log.hpp"
 #include "../cpp/lib/db.hpp"
-#include "../cpp/lib/ipc.hpp"
-#include "../cpp/lib/fifo.hpp"
-
-#define BUFFER_SIZE 16384
+#include "../cpp/lib/socket.hpp"
 
 extern char** environ;
 
 namespace fs = std::filesystem;
 
-// create_fifo() {{{
-std::expected<fs::path, std::string> create_fifo(fs::path const& path_dir_fifo, std::string_view prefix)
-{
-  ereturn_if(not fs::exists(path_dir_fifo) and not fs::create_directories(path_dir_fifo)
-    , strerror(errno)
-    , std::unexpected(strerror(errno))
-  );
-  fs::path path_file_fifo = path_dir_fifo / "{}_XXXXXX"_fmt(prefix);
-
-  // Generate a unique filename using mkstemp
-  int fd_temp = mkstemp(const_cast<char*>(path_file_fifo.c_str()));
-  ereturn_if(fd_temp == -1, strerror(errno), std::unexpected(strerror(errno)));
-
-  // Close and remove the temporary file created by mkstemp
-  close(fd_temp);
-  unlink(path_file_fifo.c_str());
-
-  // Create fifo
-  ereturn_if(mkfifo(path_file_fifo.c_str(), 0666) < 0, strerror(errno), std::unexpected(strerror(errno)));
-
-  return path_file_fifo;
-} // create_fifo() }}}
-
-// fifo_read_nonblock() {{{
-bool fifo_read_nonblock(std::ostream& os, int fd)
+// environment() {{{
+// Fills 'environment' with the entries of environ. When the daemon published the base environment
+// of the session, only entries that differ from it are sent, and removed keys go in
+// 'environment_unset'
+void environment(ns_db::Db& db, fs::path const& path_file_env_base)
 {
-  char buffer[BUFFER_SIZE];
-  ssize_t count_bytes = read(fd, &buffer, sizeof(buffer));
-  if (count_bytes == -1 and (errno == EWOULDBLOCK or errno == EAGAIN))
+  std::vector<std::string> vec_environment;
+  auto f_full = [&]
   {
-    return true;
-  } // if
-  else if (count_bytes == -1)
-  {
-    perror("read");
-    return false;
-  } // else if
-  else if (count_bytes == 0)
+    for(char **env = environ; *env != NULL; ++env) { vec_environment.push_back(*env); }
+    db("environment") = vec_environment;
+  };
+  // Map the base environment, entries are separated by '\0'
+  int fd = open(path_file_env_base.c_str(), O_RDONLY | O_CLOEXEC);
+  if ( fd < 0 ) { f_full(); return; }
+  struct stat st;
+  void* data = (fstat(fd, &st) == 0 and st.st_size > 0)?
+      mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+    : MAP_FAILED;
+  close(fd);
+  if ( data == MAP_FAILED ) { f_full(); return; }
+  // Index the base by key
+  std::unordered_map<std::string_view,std::string_view> map_base;
+  std::string_view view_base(static_cast<char const*>(data), st.st_size);
+  for (auto&& e : view_base | std::views::split('\0'))
   {
-    ns_log::debug()("No data received, the process either finished or did not start");
-    return true;
-  } // else if
-  else
+    std::string_view entry(e.begin(), e.end());
+    qcontinue_if(entry.empty());
+    map_base.emplace(entry.substr(0, entry.find('=')), entry);
+  } // for
+  // Send changed and novel entries
+  std::unordered_set<std::string_view> set_keys;
+  for(char **env = environ; *env != NULL; ++env)
   {
-    ns_log::debug()("Read '{}' bytes", count_bytes);
-    os << std::string(buffer, buffer+count_bytes);
-    return true;
-  } // else
-} // fifo_read_nonblock() }}}
-
-// fifo_to_ostream() {{{
-void fifo_to_ostream(pid_t pid_child, std::ostream& os, fs::path const& path_file_fifo)
-{
-  using namespace std::chrono_literals;
-  // Fork
-  pid_t ppid = getpid();
-  pid_t pid = fork();
-  ereturn_if(pid < 0, "Could not fork '{}'"_fmt(strerror(errno)));
-  // Parent ends here
-  qreturn_if( pid > 0 );
-  // Die with parent
-  eabort_if(prctl(PR_SET_PDEATHSIG, SIGKILL) < 0, strerror(errno));
-  eabort_if(::kill(ppid, 0) < 0, "Parent died, prctl will not have effect: {}"_fmt(strerror(errno)));
-  ns_log::debug()("{} dies with {}", getpid(), ppid);
-  // Open fifo to read
-  int fd = open(path_file_fifo.string().c_str(), O_RDONLY | O_NONBLOCK);
-  ereturn_if(fd == -1, strerror(errno));
-  // Send fifo to ostream
-  while( fifo_read_nonblock(os, fd) )
+    std::string_view entry(*env);
+    std::string_view key = entry.substr(0, entry.find('='));
+    set_keys.insert(key);
+    auto it = map_base.find(key);
+    qcontinue_if(it != map_base.end() and it->second == entry);
+    vec_environment.push_back(std::string{entry});
+  } // for
+  // Send removed keys
+  std::vector<std::string> vec_unset;
+  for (auto&& [key, entry] : map_base)
   {
-    dbreak_if(kill(pid_child, 0) < 0, "Pid has exited");
-    std::this_thread::sleep_for(100ms);
+    qcontinue_if(set_keys.contains(key));
+    vec_unset.push_back(std::string{key});
   } // for
-  // Close fifo
-  close(fd);
-  // Exit normally
-  exit(0);
-} // fifo_to_ostream() }}}
+  db("environment") = vec_environment;
+  db("environment_unset") = vec_unset;
+  munmap(data, st.st_size);
+} // environment() }}}
 
 // main() {{{
 int main(int argc, char** argv)
 {
-  using namespace std::chrono_literals;
-
   // Set log level
   ns_log::set_level(ns_env::exists("FIM_DEBUG", "1")? ns_log::Level::DEBUG : ns_log::Level::QUIET);
 
   // Check args
   ereturn_if( argc < 2, "Incorrect number arguments", EXIT_FAILURE);
 
-  // Get file path for IPC
-  const char* str_file_portal = getenv("FIM_PORTAL_FILE");
-  ereturn_if( str_file_portal == nullptr, "Could not read FIM_PORTAL_FILE", EXIT_FAILURE);
+  // Get socket of the daemon
+  const char* str_file_socket = getenv("FIM_PORTAL_SOCKET");
+  ereturn_if( str_file_socket == nullptr, "Could not read FIM_PORTAL_SOCKET", EXIT_FAILURE);
 
-  // Create ipc instance
-  auto ipc = ns_ipc::Ipc::guest(str_file_portal);
+  // Set log file, only when debugging since every call would leave one behind
+  std::error_code ec;
+  if ( const char* str_dir_mount = getenv("FIM_DIR_MOUNT"); str_dir_mount and ns_env::exists("FIM_DEBUG", "1") )
+  {
+    fs::path path_file_log = fs::path(str_dir_mount) / "portal" / "logs" / std::to_string(getpid());
+    fs::create_directories(path_file_log.parent_path(), ec);
+    if(ec) { ns_log::error()("Error to create log file: {}", ec.message()); }
+    ns_log::set_sink_file(path_file_log);
+  } // if
 
-  // Mount dir
-  const char* str_dir_mount = getenv("FIM_DIR_MOUNT");
-  ereturn_if( str_dir_mount == nullptr, "Could not read FIM_DIR_MOUNT", EXIT_FAILURE);
-  fs::path path_dir_mount(str_dir_mount);
+  // Time to wait for the daemon to accept the request
+  auto timeout = std::chrono::milliseconds(ns_exception::to_expected([]
+  {
+    return std::stoll(ns_env::get_or_else("FIM_PORTAL_TIMEOUT", "5000"));
+  }).value_or(5000));
+  auto time_deadline = std::chrono::steady_clock::now() + timeout;
 
-  // Set log file
-  fs::path path_file_log = path_dir_mount / "portal" / "logs" / std::to_string(getpid());
-  std::error_code ec;
-  fs::create_directories(path_file_log.parent_path(), ec);
-  if(ec) { ns_log::error()("Error to create log file: {}", ec.message()); }
-  ns_log::set_sink_file(path_file_log);
-
-  // Create a fifo for stdout, for stderr, and for the exit code
-  auto path_file_fifo_stdout = create_fifo(path_dir_mount / "portal" / "fifo", "stdout");
-  auto path_file_fifo_stderr = create_fifo(path_dir_mount / "portal" / "fifo", "stderr");
-  auto path_file_fifo_exit = create_fifo(path_dir_mount / "portal" / "fifo", "exit");
-  auto path_file_fifo_pid = create_fifo(path_dir_mount / "portal" / "fifo", "pid");
-  ereturn_if(not path_file_fifo_stdout, "Could not open stdout fifo", EXIT_FAILURE);
-  ereturn_if(not path_file_fifo_stderr, "Could not open stderr fifo", EXIT_FAILURE);
-  ereturn_if(not path_file_fifo_exit, "Could not open exit fifo", EXIT_FAILURE);
-  ereturn_if(not path_file_fifo_pid, "Could not open pid fifo", EXIT_FAILURE);
-
-  // Save environment
-  fs::path path_file_env = fs::path{str_dir_mount} / "portal" / "environments" / std::to_string(getpid());
-  fs::create_directories(path_file_env.parent_path(), ec);
-  ereturn_if(ec, "Could not open file '{}': '{}'"_fmt(path_file_env, ec.message()), EXIT_FAILURE);
-  std::ofstream ofile_env(path_file_env);
-  ereturn_if(not ofile_env.good(), "Could not open file '{}'"_fmt(path_file_env), EXIT_FAILURE);
-  for(char **env = environ; *env != NULL; ++env)
+  // Connect to daemon, retry while it starts
+  auto expected_fd_socket = ns_socket::connect(str_file_socket);
+  while ( not expected_fd_socket and std::chrono::steady_clock::now() < time_deadline )
   {
-    ofile_env << *env << '\n';
-  } // for
-  ofile_env.close();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    expected_fd_socket = ns_socket::connect(str_file_socket);
+  } // while
+  ereturn_if(not expected_fd_socket, expected_fd_socket.error(), EXIT_FAILURE);
 
-  // Send message
+  // Create request with the command, environment and working directory
   auto db = ns_db::Db("{}");
-  db("command") = std::vector(argv+1, argv+argc);
-  db("stdout") = path_file_fifo_stdout->c_str();
-  db("stderr") = path_file_fifo_stderr->c_str();
-  db("exit") = path_file_fifo_exit->c_str();
-  db("pid") = path_file_fifo_pid->c_str();
-  db("environment") = path_file_env;
-  ipc.send(db.dump());
-
-  // Wait for daemon to write pid
-  std::this_thread::sleep_for(500ms);
-
-  // Retrieve child pid
-  pid_t pid_child;
-  auto expected_pid_child = ns_fifo::open_and_read(path_file_fifo_pid->c_str(), std::span(&pid_child, sizeof(pid_child)));
-  ereturn_if(not expected_pid_child, expected_pid_child.error(), EXIT_FAILURE);
-  ns_log::debug()("Child pid: {}", pid_child);
-
-  // Connect to stdout and stderr with fifos
-  fifo_to_ostream(pid_child, std::cout, *path_file_fifo_stdout);
-  fifo_to_ostream(pid_child, std::cout, *path_file_fifo_stderr);
-
-  // Open exit code fifo
-  int exit_code{};
-  auto expected_exit_code = ns_fifo::open_and_read(path_file_fifo_exit->c_str(), std::span(&exit_code, sizeof(exit_code)));
+  db("command") = std::vector<std::string>(argv+1, argv+argc);
+  environment(db, std::string{str_file_socket} + ".env");
+  db("cwd") = fs::current_path(ec).string();
+
+  // Send request, the host process uses our stdin, stdout and stderr directly
+  std::array<int,3> fds{STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  auto expected_send = ns_socket::send(*expected_fd_socket, db.dump(), fds);
+  ereturn_if(not expected_send, expected_send.error(), EXIT_FAILURE);
+
+  // Wait for the acknowledgement, with the pid of the host process, an error or a queued notice
+  auto expected_ready = ns_socket::wait(*expected_fd_socket
+    , std::max(std::chrono::duration_cast<std::chrono::milliseconds>(time_deadline - std::chrono::steady_clock::now())
+      , std::chrono::milliseconds(0)
+    )
+  );
+  ereturn_if(not expected_ready, expected_ready.error(), EXIT_FAILURE);
+  ereturn_if(not *expected_ready, "Portal daemon did not answer in '{}' ms"_fmt(timeout.count()), EXIT_FAILURE);
+  auto expected_ack = ns_socket::recv(*expected_fd_socket);
+  ereturn_if(not expected_ack, expected_ack.error(), EXIT_FAILURE);
+  // The daemon queued the request behind running jobs, the pid comes once it starts
+  if ( ns_exception::to_expected([&]{ return ns_db::Db(*expected_ack).contains("queued"); }).value_or(false) )
+  {
+    ns_log::debug()("Request queued, waiting for the daemon to start it");
+    expected_ack = ns_socket::recv(*expected_fd_socket);
+    ereturn_if(not expected_ack, expected_ack.error(), EXIT_FAILURE);
+  } // if
+  auto expected_pid = ns_exception::to_expected([&]
+  {
+    auto db = ns_db::Db(*expected_ack);
+    if ( db.contains("error") ) { throw std::runtime_error(db["error"].as_string()); }
+    return db["pid"].as_string();
+  });
+  ereturn_if(not expected_pid, expected_pid.error(), 127);
+  ns_log::debug()("Child pid: {}", *expected_pid);
+
+  // Wait for the exit code
+  auto expected_reply = ns_socket::recv(*expected_fd_socket);
+  ereturn_if(not expected_reply, expected_reply.error(), EXIT_FAILURE);
+  close(*expected_fd_socket);
+  auto expected_exit_code = ns_exception::to_expected([&]
+  {
+    return std::stoi(ns_db::Db(*expected_reply)["exit"].as_string());
+  });
   ereturn_if(not expected_exit_code, expected_exit_code.error(), EXIT_FAILURE);
-  return exit_code;
+  ns_log::debug()("Exit code: {}", *expected_exit_code);
+  return *expected_exit_code;
 } // main() }}}
 
 /* vim: set expandtab fdm=marker ts=2 sw=2 tw=100 et :*/
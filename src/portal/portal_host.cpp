@@ -4,34 +4,64 @@
 ///
 
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/wait.h>
-#include <thread>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <deque>
+#include <tuple>
+#include <optional>
 #include <vector>
 #include <string>
 #include <csignal>
 #include <filesystem>
+#include <unordered_map>
 #include <unistd.h>
 
 #include "../cpp/lib/log.hpp"
-#include "../cpp/lib/ipc.hpp"
-#include "../cpp/lib/fifo.hpp"
+#include "../cpp/lib/socket.hpp"
 #include "../cpp/lib/db.hpp"
 #include "../cpp/lib/env.hpp"
+#include "../cpp/lib/subprocess.hpp"
+#include "../cpp/lib/environment.hpp"
 #include "../cpp/macro.hpp"
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 namespace fs = std::filesystem;
 
 extern char** environ;
 
-std::atomic_bool G_CONTINUE = true;
+// Requests that are running at most at the same time, others wait in a queue
+constexpr uint32_t const MAX_JOBS_DEFAULT = 32;
+
+// Signal mask before the daemon blocked the signals it waits on
+sigset_t G_SIGSET_ORIGINAL;
 
-// signal_handler() {{{
-void signal_handler(int)
+// struct Request {{{
+// A request received from a guest, with its stdin/stdout/stderr
+struct Request
+{
+  int fd_connection;
+  std::string msg;
+  std::vector<int> vec_fds;
+}; // struct Request }}}
+
+// struct Job {{{
+// A running host command, the exit code is sent to fd_connection
+struct Job
 {
-  G_CONTINUE = false;
-} // signal_handler() }}}
+  int fd_connection;
+  // Readable when the process exits, -1 if pidfd is not available
+  int fd_pid;
+}; // struct Job }}}
 
 // search_path() {{{
+// Searches the host PATH, without the directories of flatimage
 std::optional<fs::path> search_path(fs::path query)
 {
   const char* env_path = std::getenv("PATH");
@@ -45,139 +75,439 @@ std::optional<fs::path> search_path(fs::path query)
     return_if_else(fs::exists(query), query, std::nullopt);
   } // if
 
-  std::string path(env_path);
-  std::istringstream istream_path(path);
-  std::string str_getline;
-
-  while (std::getline(istream_path, str_getline, ':'))
+  std::string path_host;
+  for (auto&& e : std::string_view{env_path} | std::views::split(':'))
   {
-    fs::path path_parent = str_getline;
+    fs::path path_parent = std::string{e.begin(), e.end()};
     qcontinue_if(env_dir_static and path_parent == fs::path(env_dir_static));
     qcontinue_if(env_dir_global_bin and path_parent == fs::path(env_dir_global_bin));
-    fs::path path_full = path_parent / query;
-    qreturn_if(fs::exists(path_full), path_full);
-  } // while
+    path_host += (path_host.empty())? path_parent.string() : ":" + path_parent.string();
+  } // for
 
-  return std::nullopt;
+  return ns_subprocess::search_path(query.string(), path_host);
 } // search_path() }}}
 
-// fork_execve() {{{
-// Fork & execve child
-void fork_execve(std::string msg)
+// validate() {{{
+decltype(auto) validate(ns_db::Db const& db) noexcept
 {
-  auto db = ns_db::Db(msg);
+  try
+  {
+    return db["command"].is_array()
+      and not db["command"].empty()
+      and db["environment"].is_array()
+      and (not db.contains("environment_unset") or db["environment_unset"].is_array())
+      and db["cwd"].is_string();
+  } // try
+  catch(...)
+  {
+    return false;
+  } // catch
+} // validate() }}}
 
+// fork_execve() {{{
+// Starts the requested command with the stdin/stdout/stderr of the caller and acknowledges it
+// with the child pid once execve succeeded. Returns the pid, throws if it could not start
+pid_t fork_execve(ns_db::Db const& db
+  , ns_environment::Environment const& environment
+  , std::vector<int>& vec_fds
+  , int fd_connection)
+{
   // Get command
   std::vector<std::string> vec_argv = db["command"].as_vector();
+  std::string str_dir_cwd = db["cwd"].as_string();
+
+  // Search for command in PATH and replace vec_argv[0] with the full path to the binary
+  auto opt_path_file_command = search_path(vec_argv[0]);
+  ethrow_if(not opt_path_file_command, "'{}' not found in PATH"_fmt(vec_argv[0]));
+  vec_argv[0] = opt_path_file_command->string();
+
+  // Create arguments and environment for execve
+  std::vector<char*> vec_argv_custom;
+  std::ranges::transform(vec_argv, std::back_inserter(vec_argv_custom), [](auto&& e){ return e.data(); });
+  vec_argv_custom.push_back(nullptr);
 
-  // Ignore on empty command
-  if ( vec_argv.empty() ) { return; }
+  // The child writes errno here if execve fails, a successful execve closes it
+  int fds_status[2];
+  ethrow_if(pipe2(fds_status, O_CLOEXEC) < 0, "Could not create pipe: {}"_fmt(strerror(errno)));
 
   // Create child
   pid_t ppid = getpid();
   pid_t pid = fork();
 
   // Failed to fork
-  ereturn_if(pid < 0, "Failed to fork");
+  if ( pid < 0 )
+  {
+    close(fds_status[0]);
+    close(fds_status[1]);
+    "Failed to fork: {}"_throw(strerror(errno));
+  } // if
 
   // Is parent
   if (pid > 0)
   {
-    // Write pid to fifo
-    auto expected_bytes_pid = ns_fifo::open_and_write(db["pid"].as_string().c_str(), std::span(&pid, sizeof(pid)));
-    elog_if(not expected_bytes_pid, expected_bytes_pid.error());
-    elog_if(*expected_bytes_pid != sizeof(pid), "Could not write pid");
-    // Wait for child to finish
-    int status;
-    ereturn_if(waitpid(pid, &status, 0) < 0, "waitpid failed");
-    // Get exit code
-    int code = (not WIFEXITED(status))? 1 : WEXITSTATUS(status);
-    ns_log::debug()("Exit code: {}", code);
-    // Send exit code of child through a fifo
-    auto expected_bytes_code = ns_fifo::open_and_write(std::string(db["exit"]), std::span(&code, sizeof(code)));
-    ereturn_if(not expected_bytes_code, expected_bytes_code.error());
-    ereturn_if(*expected_bytes_code != sizeof(code), "Could not write exit code");
-    return;
+    // Only the child holds the caller's streams, so readers see end of file when it exits
+    std::ranges::for_each(vec_fds, [](int fd){ close(fd); });
+    vec_fds.clear();
+    // Check if execve succeeded
+    close(fds_status[1]);
+    int error_exec = 0;
+    ssize_t count;
+    do { count = read(fds_status[0], &error_exec, sizeof(error_exec)); } while ( count < 0 and errno == EINTR );
+    close(fds_status[0]);
+    if ( count > 0 )
+    {
+      waitpid(pid, nullptr, 0);
+      "Could not execute '{}': {}"_throw(vec_argv[0], strerror(error_exec));
+    } // if
+    // Acknowledge request
+    auto db_ack = ns_db::Db("{}");
+    db_ack("pid") = std::to_string(pid);
+    auto expected_send = ns_socket::send(fd_connection, db_ack.dump());
+    elog_if(not expected_send, expected_send.error());
+    return pid;
   } // if
 
+  // Report errors to the parent through the status pipe
+  close(fds_status[0]);
+  auto f_fail = [&]{ int error = errno; [[maybe_unused]] ssize_t _ = write(fds_status[1], &error, sizeof(error)); _exit(127); };
   // Die with daemon
-  eabort_if(prctl(PR_SET_PDEATHSIG, SIGKILL) < 0, strerror(errno));
-  eabort_if(::kill(ppid, 0) < 0, "Parent died, prctl will not have effect: {}"_fmt(strerror(errno)));
-  ns_log::debug()("{} dies with {}", getpid(), ppid);
+  if ( prctl(PR_SET_PDEATHSIG, SIGKILL) < 0 ) { f_fail(); }
+  if ( ::kill(ppid, 0) < 0 ) { f_fail(); }
 
-  // Open stdout/stderr FIFOs
-  int fd_stdout = open(db["stdout"].as_string().c_str(), O_WRONLY);
-  int fd_stderr = open(db["stderr"].as_string().c_str(), O_WRONLY);
-  eabort_if(fd_stdout < 0 or fd_stderr < 0, strerror(errno));
+  // Restore the signals blocked by the daemon
+  if ( sigprocmask(SIG_SETMASK, &G_SIGSET_ORIGINAL, nullptr) < 0 ) { f_fail(); }
 
-  // Redirect stdout and stderr
-  eabort_if(dup2(fd_stdout, STDOUT_FILENO) < 0, strerror(errno));
-  eabort_if(dup2(fd_stderr, STDERR_FILENO) < 0, strerror(errno));
+  // Use stdin, stdout and stderr of the caller, dup2 clears close-on-exec
+  for (int fd_target = 0; fd_target < static_cast<int>(vec_fds.size()); ++fd_target)
+  {
+    if ( dup2(vec_fds[fd_target], fd_target) < 0 ) { f_fail(); }
+  } // for
 
-  // Close the original file descriptors
-  close(fd_stdout);
-  close(fd_stderr);
+  // Run on the working directory of the caller if it exists on the host
+  elog_if(chdir(str_dir_cwd.c_str()) < 0, "Could not change directory to '{}'"_fmt(str_dir_cwd));
 
-  // Search for command in PATH and replace vec_argv[0] with the full path to the binary
-  auto opt_path_file_command = search_path(vec_argv[0]);
-  eabort_if(not opt_path_file_command, "'{}' not found in PATH"_fmt(vec_argv[0]));
-  vec_argv[0] = opt_path_file_command->c_str();
+  // Perform execve
+  execve(vec_argv_custom[0], vec_argv_custom.data(), environment.envp());
+
+  // Child should stop here
+  f_fail();
+  return 127;
+} // fork_execve() }}}
 
-  // Create arguments for execve
-  auto argv_custom = std::make_unique<const char*[]>(vec_argv.size()+1);
-  // Set last arg to nullptr
-  argv_custom[vec_argv.size()] = nullptr;
-  // Copy entries
-  for(size_t i = 0; i < vec_argv.size(); ++i)
+// is_hangup() {{{
+// Checks if the peer of a connection closed it
+bool is_hangup(int fd_connection)
+{
+  pollfd fd_poll{ .fd = fd_connection, .events = POLLRDHUP, .revents = 0 };
+  int count;
+  do { count = poll(&fd_poll, 1, 0); } while ( count < 0 and errno == EINTR );
+  return count > 0 and (fd_poll.revents & (POLLRDHUP | POLLHUP | POLLERR));
+} // is_hangup() }}}
+
+// reply() {{{
+// Sends the final frame and closes the connection
+void reply(int fd_connection, std::string const& key, std::string const& value)
+{
+  auto db = ns_db::Db("{}");
+  db(key) = value;
+  auto expected_send = ns_socket::send(fd_connection, db.dump());
+  elog_if(not expected_send, expected_send.error());
+  close(fd_connection);
+} // reply() }}}
+
+// class Daemon {{{
+class Daemon
+{
+  private:
+    int m_fd_epoll;
+    int m_fd_socket;
+    int m_fd_signal;
+    uint32_t m_max_jobs;
+    std::unordered_map<pid_t,Job> m_jobs;
+    // pidfd to the pid it tracks
+    std::unordered_map<int,pid_t> m_pidfds;
+    std::deque<Request> m_pending;
+    // Frames still being received, by connection
+    std::unordered_map<int,ns_socket::Receiver> m_receivers;
+    bool m_is_running;
+    // Environment of the first request, later requests only send what changed from it
+    fs::path m_path_file_env_base;
+    std::optional<ns_environment::Environment> m_opt_env_base;
+
+    void accept();
+    void receive(int fd_connection);
+    void start(Request request);
+    void finish(pid_t pid, int status);
+    void reap(pid_t pid);
+    void on_signal();
+    ns_environment::Environment environment(ns_db::Db const& db);
+
+  public:
+    Daemon(int fd_socket, uint32_t max_jobs, fs::path const& path_file_env_base);
+    ~Daemon();
+    Daemon(Daemon const&) = delete;
+    Daemon(Daemon&&) = delete;
+    Daemon& operator=(Daemon const&) = delete;
+    Daemon& operator=(Daemon&&) = delete;
+    void run();
+}; // class Daemon }}}
+
+// Daemon::Daemon() {{{
+Daemon::Daemon(int fd_socket, uint32_t max_jobs, fs::path const& path_file_env_base)
+  : m_fd_epoll(epoll_create1(EPOLL_CLOEXEC))
+  , m_fd_socket(fd_socket)
+  , m_fd_signal(-1)
+  , m_max_jobs(max_jobs)
+  , m_jobs()
+  , m_pidfds()
+  , m_pending()
+  , m_receivers()
+  , m_is_running(true)
+  , m_path_file_env_base(path_file_env_base)
+  , m_opt_env_base(std::nullopt)
+{
+  // Guests must not diff against the base of a previous daemon
+  unlink(m_path_file_env_base.c_str());
+  ethrow_if(m_fd_epoll < 0, "Could not create epoll instance: {}"_fmt(strerror(errno)));
+  // Receive termination and child exits as events
+  sigset_t sigset;
+  sigemptyset(&sigset);
+  sigaddset(&sigset, SIGTERM);
+  sigaddset(&sigset, SIGINT);
+  sigaddset(&sigset, SIGCHLD);
+  ethrow_if(sigprocmask(SIG_BLOCK, &sigset, &G_SIGSET_ORIGINAL) < 0, "Could not block signals");
+  m_fd_signal = signalfd(-1, &sigset, SFD_CLOEXEC | SFD_NONBLOCK);
+  ethrow_if(m_fd_signal < 0, "Could not create signalfd: {}"_fmt(strerror(errno)));
+  for (int fd : {m_fd_socket, m_fd_signal})
   {
-    argv_custom[i] = vec_argv[i].c_str();
+    epoll_event event{ .events = EPOLLIN, .data = { .fd = fd } };
+    ethrow_if(epoll_ctl(m_fd_epoll, EPOLL_CTL_ADD, fd, &event) < 0, "Could not watch fd: {}"_fmt(strerror(errno)));
   } // for
+} // Daemon::Daemon() }}}
 
-  // Fetch environment from db
-  fs::path path_file_environment = db["environment"].as_string();
-  std::vector<std::string> vec_environment;
-  std::ifstream file_environment(path_file_environment);
-  eabort_if(not file_environment.is_open(), "Could not open {}"_fmt(path_file_environment));
-  for (std::string entry; std::getline(file_environment, entry);)
+// Daemon::~Daemon() {{{
+Daemon::~Daemon()
+{
+  std::ranges::for_each(m_pending, [](auto&& request)
   {
-    vec_environment.push_back(entry);
-  } // for
-  file_environment.close();
-  // Create environment for execve
-  auto env_custom = std::make_unique<const char*[]>(vec_environment.size()+1);
-  // Set last arg to nullptr
-  env_custom[vec_environment.size()] = nullptr;
-  // Copy entries
-  for(size_t i = 0; i < vec_environment.size(); ++i)
-  {
-    env_custom[i] = vec_environment[i].c_str();
-  } // for
+    std::ranges::for_each(request.vec_fds, [](int fd){ close(fd); });
+    close(request.fd_connection);
+  });
+  std::ranges::for_each(m_jobs, [](auto&& e){ close(e.second.fd_connection); if ( e.second.fd_pid >= 0 ) { close(e.second.fd_pid); } });
+  std::ranges::for_each(m_receivers, [](auto&& e){ close(e.first); });
+  close(m_fd_signal);
+  close(m_fd_epoll);
+  unlink(m_path_file_env_base.c_str());
+} // Daemon::~Daemon() }}}
+
+// Daemon::environment() {{{
+// Builds the environment of a request. A full one is kept as the base of the session and
+// published to m_path_file_env_base, a delta sets 'environment' and erases 'environment_unset'
+// on top of the base
+ns_environment::Environment Daemon::environment(ns_db::Db const& db)
+{
+  ns_environment::Environment environment;
+  bool is_delta = db.contains("environment_unset");
+  if ( is_delta )
+  {
+    ethrow_if(not m_opt_env_base, "Received environment delta without a base environment");
+    std::ranges::for_each(*m_opt_env_base, [&](char const* e){ environment.set(e); });
+    for (auto&& key : db["environment_unset"].as_vector()) { environment.erase(key); }
+  } // if
+  for (auto&& entry : db["environment"].as_vector()) { environment.set(entry); }
+  qreturn_if(is_delta or m_opt_env_base, environment);
+  // First full environment, write it separated by '\0' and move it in place atomically
+  ns_environment::Environment& env_base = m_opt_env_base.emplace();
+  std::ranges::for_each(environment, [&](char const* e){ env_base.set(e); });
+  fs::path path_file_tmp = m_path_file_env_base.string() + ".tmp";
+  std::string data;
+  std::ranges::for_each(env_base, [&](char const* e){ data.append(e); data.push_back('\0'); });
+  int fd = open(path_file_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  ereturn_if(fd < 0, "Could not create base environment file: {}"_fmt(strerror(errno)), environment);
+  bool is_written = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+  close(fd);
+  if ( not is_written or rename(path_file_tmp.c_str(), m_path_file_env_base.c_str()) < 0 )
+  {
+    ns_log::error()("Could not write base environment file: {}", strerror(errno));
+    unlink(path_file_tmp.c_str());
+  } // if
+  return environment;
+} // Daemon::environment() }}}
 
-  // Perform execve
-  execve(argv_custom[0], (char**) argv_custom.get(), (char**) env_custom.get());
+// Daemon::accept() {{{
+void Daemon::accept()
+{
+  // Non-blocking, a slow guest must not stall the requests of other connections
+  int fd_connection = accept4(m_fd_socket, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  ereturn_if(fd_connection < 0, "Failed to accept connection: {}"_fmt(strerror(errno)));
+  epoll_event event{ .events = EPOLLIN, .data = { .fd = fd_connection } };
+  if ( epoll_ctl(m_fd_epoll, EPOLL_CTL_ADD, fd_connection, &event) < 0 )
+  {
+    ns_log::error()("Could not watch connection: {}", strerror(errno));
+    close(fd_connection);
+    return;
+  } // if
+  m_receivers.try_emplace(fd_connection);
+} // Daemon::accept() }}}
 
-  // Child should stop here
-  std::abort();
-} // fork_execve() }}}
+// Daemon::receive() {{{
+// Reads what arrived of the request of a connection, once complete starts it or queues it when
+// at the limit
+void Daemon::receive(int fd_connection)
+{
+  auto it = m_receivers.find(fd_connection);
+  qreturn_if(it == m_receivers.end());
+  auto expected_complete = it->second.read(fd_connection);
+  qreturn_if(expected_complete and not *expected_complete);
+  epoll_ctl(m_fd_epoll, EPOLL_CTL_DEL, fd_connection, nullptr);
+  if ( not expected_complete )
+  {
+    // The receiver closes the file descriptors it collected
+    ns_log::error()(expected_complete.error());
+    m_receivers.erase(it);
+    close(fd_connection);
+    return;
+  } // if
+  Request request{ .fd_connection = fd_connection, .msg = {}, .vec_fds = {} };
+  std::tie(request.msg, request.vec_fds) = it->second.take();
+  m_receivers.erase(it);
+  // Replies are small and sent at once
+  fcntl(fd_connection, F_SETFL, fcntl(fd_connection, F_GETFL) & ~O_NONBLOCK);
+  ns_log::info()("Recovered message: {}", request.msg);
+  if ( m_jobs.size() >= m_max_jobs )
+  {
+    ns_log::debug()("Reached '{}' jobs, queueing request", m_max_jobs);
+    // Acknowledge the request, the caller then waits for the pid without a timeout
+    auto db_ack = ns_db::Db("{}");
+    db_ack("queued") = std::to_string(m_pending.size() + 1);
+    auto expected_send = ns_socket::send(fd_connection, db_ack.dump());
+    if ( not expected_send )
+    {
+      ns_log::error()(expected_send.error());
+      std::ranges::for_each(request.vec_fds, [](int fd){ close(fd); });
+      close(fd_connection);
+      return;
+    } // if
+    m_pending.push_back(std::move(request));
+    return;
+  } // if
+  start(std::move(request));
+} // Daemon::receive() }}}
 
-// validate() {{{
-decltype(auto) validate(std::string_view msg) noexcept
+// Daemon::start() {{{
+void Daemon::start(Request request)
 {
-  try
+  auto expected_pid = ns_exception::to_expected([&]
   {
-    auto db = ns_db::Db(msg);
-    return db["command"].is_array()
-      and db["stdout"].is_string()
-      and db["stderr"].is_string()
-      and db["exit"].is_string()
-      and db["pid"].is_string()
-      and db["environment"].is_string();
-  } // try
-  catch(...)
+    auto db = ns_db::Db(request.msg);
+    ethrow_if(not validate(db), "Failed to validate message");
+    ethrow_if(request.vec_fds.size() != 3, "Expected 3 file descriptors, got '{}'"_fmt(request.vec_fds.size()));
+    return fork_execve(db, environment(db), request.vec_fds, request.fd_connection);
+  });
+  std::ranges::for_each(request.vec_fds, [](int fd){ close(fd); });
+  // Reply with the error if the command did not start
+  if ( not expected_pid )
   {
-    return false;
-  } // catch
-} // validate() }}}
+    ns_log::error()(expected_pid.error());
+    reply(request.fd_connection, "error", expected_pid.error());
+    return;
+  } // if
+  // Track the process, without pidfd the exit is found on SIGCHLD
+  pid_t pid = *expected_pid;
+  int fd_pid = syscall(SYS_pidfd_open, pid, 0);
+  if ( fd_pid >= 0 )
+  {
+    epoll_event event{ .events = EPOLLIN, .data = { .fd = fd_pid } };
+    epoll_ctl(m_fd_epoll, EPOLL_CTL_ADD, fd_pid, &event);
+    m_pidfds[fd_pid] = pid;
+  } // if
+  m_jobs[pid] = Job{ .fd_connection = request.fd_connection, .fd_pid = fd_pid };
+  // The process might have exited before it was tracked
+  reap(pid);
+} // Daemon::start() }}}
+
+// Daemon::reap() {{{
+// Collects the exit status of a job if it finished
+void Daemon::reap(pid_t pid)
+{
+  int status;
+  qreturn_if(waitpid(pid, &status, WNOHANG) <= 0);
+  finish(pid, status);
+} // Daemon::reap() }}}
+
+// Daemon::finish() {{{
+void Daemon::finish(pid_t pid, int status)
+{
+  auto it = m_jobs.find(pid);
+  qreturn_if(it == m_jobs.end());
+  Job job = it->second;
+  m_jobs.erase(it);
+  if ( job.fd_pid >= 0 )
+  {
+    epoll_ctl(m_fd_epoll, EPOLL_CTL_DEL, job.fd_pid, nullptr);
+    m_pidfds.erase(job.fd_pid);
+    close(job.fd_pid);
+  } // if
+  // Send the exit code
+  int code = (not WIFEXITED(status))? 1 : WEXITSTATUS(status);
+  ns_log::debug()("Exit code of '{}': {}", pid, code);
+  reply(job.fd_connection, "exit", std::to_string(code));
+  // Start queued requests
+  while ( not m_pending.empty() and m_jobs.size() < m_max_jobs )
+  {
+    Request request = std::move(m_pending.front());
+    m_pending.pop_front();
+    // Drop requests whose caller left while queued
+    if ( is_hangup(request.fd_connection) )
+    {
+      ns_log::debug()("Caller of queued request left, dropping it");
+      std::ranges::for_each(request.vec_fds, [](int fd){ close(fd); });
+      close(request.fd_connection);
+      continue;
+    } // if
+    start(std::move(request));
+  } // while
+} // Daemon::finish() }}}
+
+// Daemon::on_signal() {{{
+void Daemon::on_signal()
+{
+  signalfd_siginfo info;
+  while ( read(m_fd_signal, &info, sizeof(info)) == sizeof(info) )
+  {
+    if ( info.ssi_signo == SIGTERM or info.ssi_signo == SIGINT )
+    {
+      m_is_running = false;
+    } // if
+    else if ( info.ssi_signo == SIGCHLD )
+    {
+      // Signals coalesce, check every job not tracked by a pidfd
+      std::vector<pid_t> vec_pids;
+      for (auto&& [pid, job] : m_jobs) { if ( job.fd_pid < 0 ) { vec_pids.push_back(pid); } }
+      std::ranges::for_each(vec_pids, [this](pid_t pid){ reap(pid); });
+    } // else if
+  } // while
+} // Daemon::on_signal() }}}
+
+// Daemon::run() {{{
+void Daemon::run()
+{
+  std::array<epoll_event,64> events;
+  while ( m_is_running )
+  {
+    int count = epoll_wait(m_fd_epoll, events.data(), events.size(), -1);
+    qcontinue_if(count < 0 and errno == EINTR);
+    ebreak_if(count < 0, "Failed to wait for events: {}"_fmt(strerror(errno)));
+    for (int i = 0; i < count; ++i)
+    {
+      int fd = events[i].data.fd;
+      if ( fd == m_fd_socket ) { accept(); }
+      else if ( fd == m_fd_signal ) { on_signal(); }
+      else if ( auto it = m_pidfds.find(fd); it != m_pidfds.end() ) { reap(it->second); }
+      else { receive(fd); }
+    } // for
+  } // while
+} // Daemon::run() }}}
 
 // main() {{{
 int main(int argc, char** argv)
@@ -187,28 +517,26 @@ int main(int argc, char** argv)
   ns_log::set_sink_file(path_file_log);
   ns_log::set_level((ns_env::exists("FIM_DEBUG", "1"))? ns_log::Level::DEBUG : ns_log::Level::ERROR);
 
-  signal(SIGTERM, signal_handler);
-  signal(SIGINT, signal_handler);
-
   // Check args
   ereturn_if(argc != 2, "Incorrect number of arguments", EXIT_FAILURE);
 
-  // Create ipc instance
-  auto ipc = ns_ipc::Ipc::host(argv[1]);
-
-  // Recover messages
-  while (G_CONTINUE)
+  // Limit of concurrent requests
+  uint32_t max_jobs = ns_exception::to_expected([]
   {
-    auto opt_msg = ipc.recv();
+    return static_cast<uint32_t>(std::stoul(ns_env::get_or_else("FIM_PORTAL_MAX_JOBS", std::to_string(MAX_JOBS_DEFAULT))));
+  }).value_or(MAX_JOBS_DEFAULT);
+  max_jobs = std::max(max_jobs, uint32_t{1});
 
-    ibreak_if(opt_msg == std::nullopt, "Empty message");
+  // Listen for guest connections
+  fs::path path_file_socket = argv[1];
+  auto expected_fd_socket = ns_socket::listen(path_file_socket);
+  ereturn_if(not expected_fd_socket, expected_fd_socket.error(), EXIT_FAILURE);
 
-    ns_log::info()("Recovered message: {}", *opt_msg);
+  // Serve requests until SIGTERM
+  ns_log::exception([&]{ Daemon(*expected_fd_socket, max_jobs, path_file_socket.string() + ".env").run(); });
 
-    econtinue_if(not validate(*opt_msg), "Failed to validate message");
-
-    fork_execve(*opt_msg);
-  } // while
+  close(*expected_fd_socket);
+  unlink(path_file_socket.c_str());
 
   return EXIT_SUCCESS;
 } // main() }}}